@@ -6,18 +6,83 @@
 /**************************************************************************/
 #include "DFRNFC.h"
 
-const uint8_t wakeDummy[]={ PN532_WAKEUP,PN532_WAKEUP, 0x00, 0x00};
+const uint8_t wakeDummy[] PROGMEM = { PN532_WAKEUP,PN532_WAKEUP, 0x00, 0x00};
 
-byte pn532ack[] = {0x00, 0x00, 0xFF, 0x00, 0xFF, 0x00};
-byte pn532response_firmwarevers[] = {0x00, 0x00, 0xFF, 0x06, 0xFA, 0xD5, 0x03};
-uint8_t DataBlockAddr[] = {1,2,4,5,6,8,9,10,12,13,14,16,17,18,20,21,22,24,25,26,28,29,30,32,33,34,36,37,38,40,41,42,44,45,46,48,49,50,52,53,54,56,57,58,60,61,62};
-bool isDataBlock[] ={0,1,1,0,1,1,1,0,1,1,1,0,1,1,1,0,1,1,1,0,1,1,1,0,1,1,1,0,1,1,1,0,1,1,1,0,1,1,1,0,1,1,1,0,1,1,1,0,1,1,1,0,1,1,1,0,1,1,1,0,1,1,1,0};
-uint8_t keyuniversal[6] = {0xFF,0xFF,0xFF,0xFF,0xFF,0xFF};
-// Uncomment these lines to enable debug output for PN532(SPI) and/or MIFARE related code
-// #define PN532DEBUG
-// #define MIFAREDEBUG
+// Constant tables live in flash, read them with pgm_read_byte/memcpy_P
+const uint8_t pn532ack[] PROGMEM = {0x00, 0x00, 0xFF, 0x00, 0xFF, 0x00};
+const uint8_t pn532nack[] PROGMEM = {0x00, 0x00, 0xFF, 0xFF, 0x00, 0x00};
+const uint8_t DataBlockAddr[] PROGMEM = {1,2,4,5,6,8,9,10,12,13,14,16,17,18,20,21,22,24,25,26,28,29,30,32,33,34,36,37,38,40,41,42,44,45,46,48,49,50,52,53,54,56,57,58,60,61,62};
+#define DATABLOCKADDR(index) pgm_read_byte(DataBlockAddr + (index))
+const uint8_t keyuniversal[6] PROGMEM = {0xFF,0xFF,0xFF,0xFF,0xFF,0xFF};
+// Frame templates: header length, checksum of the bytes from TFI on, then
+// the header itself with LEN and LCS covering only these bytes
+const uint8_t frameGetFirmwareVersion[] PROGMEM = {7, 0xD6, 0x00, 0x00, 0xFF, 0x02, 0xFE, 0xD4, 0x02};
+const uint8_t frameSAMConfig[] PROGMEM = {10, 0xFE, 0x00, 0x00, 0xFF, 0x05, 0xFB, 0xD4, 0x14, 0x01, 0x14, 0x01};  // normal, 1 s, IRQ
+const uint8_t frameListTarget[] PROGMEM = {9, 0x1F, 0x00, 0x00, 0xFF, 0x04, 0xFC, 0xD4, 0x4A, 0x01, 0x00};   // 1 target, 106 kbps type A
+const uint8_t frameDataExchange[] PROGMEM = {8, 0x15, 0x00, 0x00, 0xFF, 0x03, 0xFD, 0xD4, 0x40, 0x01};      // InDataExchange with target 1
+const PN532RetryPolicy defaultRetryPolicy = {1, 1, 1, 0, 20, PN532_TIMEOUT};
+const uint8_t keyndef[6] PROGMEM = {0xD3,0xF7,0xD3,0xF7,0xD3,0xF7};  // NFC Forum public key A of NDEF sectors
+// Blocks written by mifareclassic_FormatNDEF and mifareclassic_WriteNDEFURI
+const uint8_t ndefMad1[16] PROGMEM = {0x14, 0x01, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1};
+const uint8_t ndefMad2[16] PROGMEM = {0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1};
+const uint8_t ndefMadTrailer[16] PROGMEM = {0xA0, 0xA1, 0xA2, 0xA3, 0xA4, 0xA5, 0x78, 0x77, 0x88, 0xC1, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+const uint8_t ndefSectorTrailer[16] PROGMEM = {0xD3, 0xF7, 0xD3, 0xF7, 0xD3, 0xF7, 0x7F, 0x07, 0x88, 0x40, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+// NDEF URI identifier codes 0x00..0x23, '\0' separated and indexed by code
+#define NDEF_URIPREFIX_COUNT 36
+const char uriPrefixTable[] PROGMEM =
+  "\0"                            // 0x00
+  "http://www.\0"                 // 0x01
+  "https://www.\0"                // 0x02
+  "http://\0"                     // 0x03
+  "https://\0"                    // 0x04
+  "tel:\0"                        // 0x05
+  "mailto:\0"                     // 0x06
+  "ftp://anonymous:anonymous@\0"  // 0x07
+  "ftp://ftp.\0"                  // 0x08
+  "ftps://\0"                     // 0x09
+  "sftp://\0"                     // 0x0A
+  "smb://\0"                      // 0x0B
+  "nfs://\0"                      // 0x0C
+  "ftp://\0"                      // 0x0D
+  "dav://\0"                      // 0x0E
+  "news:\0"                       // 0x0F
+  "telnet://\0"                   // 0x10
+  "imap:\0"                       // 0x11
+  "rtsp://\0"                     // 0x12
+  "urn:\0"                        // 0x13
+  "pop:\0"                        // 0x14
+  "sip:\0"                        // 0x15
+  "sips:\0"                       // 0x16
+  "tftp:\0"                       // 0x17
+  "btspp://\0"                    // 0x18
+  "btl2cap://\0"                  // 0x19
+  "btgoep://\0"                   // 0x1A
+  "tcpobex://\0"                  // 0x1B
+  "irdaobex://\0"                 // 0x1C
+  "file://\0"                     // 0x1D
+  "urn:epc:id:\0"                 // 0x1E
+  "urn:epc:tag:\0"                // 0x1F
+  "urn:epc:pat:\0"                // 0x20
+  "urn:epc:raw:\0"                // 0x21
+  "urn:epc:\0"                    // 0x22
+  "urn:nfc:\0"                    // 0x23
+;
+
+#ifdef PN532STATS
+    #define PN532_COUNT(counter) (_stats.counter++)
+#else
+    #define PN532_COUNT(counter)
+#endif
+
+#ifdef PN532TRACE
+    #define PN532_TRACE(...) trace(__VA_ARGS__)
+#else
+    #define PN532_TRACE(...)
+#endif
 
 #define PN532_PACKBUFFSIZ 64
+#define PN532_NOSECTOR 0xFF   // no sector authenticated
 byte pn532_packetbuffer[PN532_PACKBUFFSIZ];
 
 #ifndef _BV
@@ -33,10 +98,32 @@ byte pn532_packetbuffer[PN532_PACKBUFFSIZ];
 void DFRNFC::begin(Stream &theSerial) 
 {
   _serial=&theSerial;
-  _serial->write(wakeDummy,3); //you have to write a wakedummy before the command to wake up PN532
+  _serial->setTimeout(PN532_TIMEOUT);
+  memcpy_P(_frame, wakeDummy, 3);
+  _serial->write(_frame,3); //you have to write a wakedummy before the command to wake up PN532
+  _asleep = 0;
+  resetPowerStats();
+  resetStats();
+  setTraceHook(0);
+  setRetryPolicy(&defaultRetryPolicy);
+  resetRetryStats();
+  _scanCount = 0;
+  _scanCallback = 0;
+  resetScanStats();
+  _latencyAverage = 0;
+  _lastError = PN532_ERROR_NONE;
+  _lastStatus = 0;
   
-  SAMConfig(); // active PN532 to normal mode
+  initchip(); // active PN532 to normal mode and cache its firmware version
   fS50found = 0;
+  _authSector = PN532_NOSECTOR;
+  _generation = 0;
+  _capacityGeneration = _generation - 1;   // nothing cached
+  _sessionTimeout = PN532_SESSION_TIMEOUT;
+  _depTarget = 1;
+  _depBaudrate = PN532_BAUDRATE_106K;
+  _depBytes = 0;
+  _depMicros = 0;
 }
  
  
@@ -49,23 +136,17 @@ void DFRNFC::begin(Stream &theSerial)
 /**************************************************************************/
 uint8_t DFRNFC::getFirmwareVersion(uint8_t *version) {
 
-  pn532_packetbuffer[0] = PN532_COMMAND_GETFIRMWAREVERSION;
-  
-  if (!sendCommandCheckAck(pn532_packetbuffer, 1))
+  if (!sendcheckack(frameGetFirmwareVersion, 0, 0, 0, 0))
     return 0;
   
   // read data packet
-  readdata(pn532_packetbuffer, 13);
-  
-  // check some basic stuff
-  if (0 != strncmp((char *)pn532_packetbuffer, (char *)pn532response_firmwarevers, 7)) {
+  if (readframe(PN532_COMMAND_GETFIRMWAREVERSION, pn532_packetbuffer, 4) != 4)
     return 0;
-  }
   
-  version[0] = pn532_packetbuffer[7];  // IC hex 
-  version[1] = pn532_packetbuffer[8];  // Version
-  version[2] = pn532_packetbuffer[9];  // Revision
-  version[3] = pn532_packetbuffer[10]; // Support
+  version[0] = pn532_packetbuffer[0];  // IC hex 
+  version[1] = pn532_packetbuffer[1];  // Version
+  version[2] = pn532_packetbuffer[2];  // Revision
+  version[3] = pn532_packetbuffer[3];  // Support
 
   return 1;
 }
@@ -77,40 +158,107 @@ uint8_t DFRNFC::getFirmwareVersion(uint8_t *version) {
 
     @param  cmd       Pointer to the command buffer
     @param  cmdlen    The size of the command in bytes 
-    @param  timeout   timeout before giving up
+    @param  body      Optional data sent after cmd in the same frame,
+                      straight from the caller's buffer
+    @param  bodylen   The size of body in bytes
     
     @returns  1 if everything is OK, 0 if timeout occured before an
-              ACK was recieved
+              ACK was recieved or cmd and body do not fit in one frame
+              (more than 254 bytes)
 */
 /**************************************************************************/
 // default timeout of one second
-boolean DFRNFC::sendCommandCheckAck(uint8_t *cmd, uint8_t cmdlen) 
+boolean DFRNFC::sendCommandCheckAck(uint8_t *cmd, uint8_t cmdlen, const uint8_t *body, uint8_t bodylen) 
+{
+  // LEN counts the TFI too, more would wrap it
+  if ((uint16_t)cmdlen + bodylen > 254)
+  {
+    _lastError = PN532_ERROR_RANGE;
+    return 0;
+  }
+  return sendcheckack(0, cmd, cmdlen, body, bodylen);
+}
+
+/**************************************************************************/
+/*! 
+    @brief  sendCommandCheckAck for a command that starts with a frame
+            template from PROGMEM, followed by cmd and body
+
+    @param  prebuilt  Frame template, 0 to build the whole frame from
+                      cmd and body
+*/
+/**************************************************************************/
+boolean DFRNFC::sendcheckack(const uint8_t *prebuilt, uint8_t *cmd, uint8_t cmdlen, const uint8_t *body, uint8_t bodylen)
 {
-  while(Serial.read() >= 0); //clear all the receive buff
+  boolean waking = _asleep;
+  unsigned long start = 0;
+
+  if (waking)
+  {
+    start = micros();
+    wakeup();
+  }
+
+  while(_serial->read() >= 0); //clear all the receive buff
+  _lastError = PN532_ERROR_NONE;
+  _commandStart = micros();
+  PN532_COUNT(commands);
   // write the command
-  writecommand(cmd, cmdlen);
+  writecommand(prebuilt, cmd, cmdlen, body, bodylen);
   boolean success = readack();
+  if (!success)
+    _initialized = 0;   // no ACK, the PN532 may have been reset
+
+  if (waking && !success)
+  {
+    // The PN532 lost its configuration while asleep, redo the full
+    // initialisation and send the command once more
+    _powerStats.reinits++;
+    PN532_COUNT(retries);
+    SAMConfig();
+    while(_serial->read() >= 0);
+    writecommand(prebuilt, cmd, cmdlen, body, bodylen);
+    success = readack();
+    _initialized = success;
+  }
+  if (waking && success)
+  {
+    uint32_t latency = micros() - start;
+    _powerStats.lastWakeMicros = latency;
+    if (latency > _powerStats.maxWakeMicros)
+      _powerStats.maxWakeMicros = latency;
+  }
   return success;
 }
 
 /**************************************************************************/
 /*! 
-    @brief  Configures the SAM (Secure Access Module)
+    @brief  Configures the SAM (Secure Access Module) for normal mode
+
+    @param  timeout   Virtual card timeout in 50 ms steps, 0x14 = 1 second
+    @param  useIRQ    1 to let the PN532 drive its IRQ pin
 */
 /**************************************************************************/
-boolean DFRNFC::SAMConfig(void) {
-  pn532_packetbuffer[0] = PN532_COMMAND_SAMCONFIGURATION;
-  pn532_packetbuffer[1] = 0x01; // normal mode;
-  pn532_packetbuffer[2] = 0x14; // timeout 50ms * 20 = 1 second
-  pn532_packetbuffer[3] = 0x01; // use IRQ pin!
+boolean DFRNFC::SAMConfig(uint8_t timeout, boolean useIRQ) {
+  // local buffers, this also runs in the middle of a command after a wake-up
+  uint8_t cmd[4];
+  uint8_t response;
+
+  cmd[0] = PN532_COMMAND_SAMCONFIGURATION;
+  cmd[1] = 0x01; // normal mode;
+  cmd[2] = timeout;
+  cmd[3] = useIRQ ? 0x01 : 0x00;
   
-  if (!sendCommandCheckAck(pn532_packetbuffer, 4))
+  boolean acked;
+  if (timeout == 0x14 && useIRQ)
+    acked = sendcheckack(frameSAMConfig, 0, 0, 0, 0);
+  else
+    acked = sendCommandCheckAck(cmd, 4);
+  if (!acked)
        return false;
 
   // read data packet
-  readdata(pn532_packetbuffer, 9);
-  
-  return  (pn532_packetbuffer[6] == 0x15);
+  return (readframe(PN532_COMMAND_SAMCONFIGURATION, &response, 1) == 0);
 }
 
 /**************************************************************************/
@@ -124,190 +272,234 @@ boolean DFRNFC::SAMConfig(void) {
 */
 /**************************************************************************/
 boolean DFRNFC::setPassiveActivationRetries(uint8_t maxRetries) {
-  pn532_packetbuffer[0] = PN532_COMMAND_RFCONFIGURATION;
-  pn532_packetbuffer[1] = 5;    // Config item 5 (MaxRetries)
-  pn532_packetbuffer[2] = 0xFF; // MxRtyATR (default = 0xFF)
-  pn532_packetbuffer[3] = 0x01; // MxRtyPSL (default = 0x01)
-  pn532_packetbuffer[4] = maxRetries;
-
-#ifdef MIFAREDEBUG
-  _serial->print("Setting MxRtyPassiveActivation to "); _serial->print(maxRetries, DEC); _serial->println(" ");
-#endif
-  
-  if (! sendCommandCheckAck(pn532_packetbuffer, 5))
-    return 0x0;  // no ACK
-  
-  return 1;
+  // MxRtyATR and MxRtyPSL keep their defaults (0xFF, 0x01)
+  return setMaxRetries(0xFF, 0x01, maxRetries);
 }
 
-/***** ISO14443A Commands ******/
+/***** Power Management ******/
 
 /**************************************************************************/
 /*! 
-    Waits for an ISO14443A target to enter the field
-    
-    @param  cardBaudRate  Baud rate of the card
-    @param  uid           Pointer to the array that will be populated
-                          with the card's UID (up to 7 bytes)
-    @param  uidLength     Pointer to the variable that will hold the
-                          length of the card's UID.
+    @brief  Puts the PN532 into PowerDown. The next command wakes it up
+            again over HSU, without a new SAMConfig unless the PN532
+            does not answer.
+
+    @param  wakeSources   PN532_WAKEUP_* flags, HSU is always added so
+                          the library can wake the chip
     
-    @returns 1 if everything executed properly, 0 for an error
+    @returns 1 if the PN532 went to sleep, 0 for an error
 */
 /**************************************************************************/
-boolean DFRNFC::readPassiveTargetID(uint8_t cardbaudrate, uint8_t * uid, uint8_t * uidLength) {
-  pn532_packetbuffer[0] = PN532_COMMAND_INLISTPASSIVETARGET;
-  pn532_packetbuffer[1] = 1;  // max 1 cards at once (we can set this to 2 later)
-  pn532_packetbuffer[2] = cardbaudrate;
-  
-  if (!sendCommandCheckAck(pn532_packetbuffer, 3))
-    return 0x0;  // no cards read
-  
-  // read data packet
-  readdata(pn532_packetbuffer, 19);
-  // check some basic stuff
+boolean DFRNFC::powerDown(uint8_t wakeSources)
+{
+  pn532_packetbuffer[0] = PN532_COMMAND_POWERDOWN;
+  pn532_packetbuffer[1] = wakeSources | PN532_WAKEUP_HSU;
 
-  /* ISO14443A card response should be in the following format:
-  
-    byte            Description
-    -------------   ------------------------------------------
-    b0..6           Frame header and preamble
-    b7              Tags Found
-    b8              Tag Number (only one used in this example)
-    b9..10          SENS_RES
-    b11             SEL_RES
-    b12             NFCID Length
-    b13..NFCIDLen   NFCID                                      */
-  
-#ifdef MIFAREDEBUG
-    _serial->print("Found "); _serial->print(pn532_packetbuffer[7], DEC); _serial->println(" tags");
-#endif
-  if (pn532_packetbuffer[7] != 1) 
+  if (!sendCommandCheckAck(pn532_packetbuffer, 2))
     return 0;
-    
-  uint16_t sens_res = pn532_packetbuffer[9];
-  sens_res <<= 8;
-  sens_res |= pn532_packetbuffer[10];
-#ifdef MIFAREDEBUG
-    _serial->print("ATQA: 0x");  _serial->println(sens_res, HEX); 
-    _serial->print("SAK: 0x");  _serial->println(pn532_packetbuffer[11], HEX); 
+  if (readframe(PN532_COMMAND_POWERDOWN, pn532_packetbuffer, 1) < 1)
+    return 0;
+  if (!checkstatus(pn532_packetbuffer[0]))
+    return 0;
+
+  _asleep = 1;
+  _sleepStart = millis();
+  _powerStats.sleeps++;
+  fS50found = 0;   // the field is off, the card has to be selected again
+  return 1;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Clears the power management counters
+*/
+/**************************************************************************/
+void DFRNFC::resetPowerStats(void)
+{
+  memset (&_powerStats, 0, sizeof(_powerStats));
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Copies the command counters and the latency histogram
+
+    @param  stats     Receives the counters, all zero unless the library
+                      is built with PN532STATS
+*/
+/**************************************************************************/
+void DFRNFC::stats(PN532Stats *stats)
+{
+#ifdef PN532STATS
+  *stats = _stats;
+#else
+  memset (stats, 0, sizeof(*stats));
 #endif
-  
-  /* Card appears to be Mifare Classic */
-  this->uidLength = *uidLength = pn532_packetbuffer[12];
-#ifdef MIFAREDEBUG
-    _serial->print("UID:"); 
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Clears the command counters
+*/
+/**************************************************************************/
+void DFRNFC::resetStats(void)
+{
+#ifdef PN532STATS
+  memset (&_stats, 0, sizeof(_stats));
 #endif
-  for (uint8_t i=0; i < pn532_packetbuffer[12]; i++) 
-  {
-    uid[i] = pn532_packetbuffer[13+i];
-    _uid[i] = pn532_packetbuffer[13+i];
-#ifdef MIFAREDEBUG
-      _serial->print(" 0x");_serial->print(uid[i], HEX); 
+}
+
+/**************************************************************************/
+/*! 
+    @brief  RAM the library takes: one DFRNFC and the shared packet
+            buffer. Buffers handed in by the caller (trace, capture,
+            scan) are not counted, ramUsage(PN532RamUsage *) lists the
+            parts
+
+    @returns  Bytes of RAM
+*/
+/**************************************************************************/
+uint16_t DFRNFC::ramUsage(void)
+{
+  return sizeof(DFRNFC) + sizeof(pn532_packetbuffer);
+}
+
+/**************************************************************************/
+/*! 
+    @brief  RAM of the library piece by piece, for the PN532STATS and
+            PN532TRACE settings of this build
+
+    @param  usage     Receives the sizes in bytes
+*/
+/**************************************************************************/
+void DFRNFC::ramUsage(PN532RamUsage *usage)
+{
+  usage->instance = sizeof(DFRNFC);
+  usage->packetBuffer = sizeof(pn532_packetbuffer);
+  usage->frame = PN532_FRAMEBUFFSIZ;
+#ifdef PN532STATS
+  usage->stats = sizeof(PN532Stats);
+#else
+  usage->stats = 0;
 #endif
-  }
-#ifdef MIFAREDEBUG
-    _serial->println();
+#ifdef PN532TRACE
+  usage->trace = sizeof(PN532TraceHook) + sizeof(void *) + sizeof(uint8_t);
+#else
+  usage->trace = 0;
 #endif
-    
-  fS50found = 1;
-  return 1;
+  usage->capture = sizeof(PN532Capture);
 }
 
+/**************************************************************************/
+/*! 
+    @brief  Clears the counters of the retry policy
+*/
+/**************************************************************************/
+void DFRNFC::resetRetryStats(void)
+{
+  memset (&_retryStats, 0, sizeof(_retryStats));
+}
 
-/***** Mifare Classic Functions ******/
+/**************************************************************************/
+/*! 
+    @brief  Installs a function that receives every frame, ACK and error.
+            Only available when the library is built with PN532TRACE,
+            the hook must not talk to the PN532 itself
+
+    @param  hook      The trace function, 0 to remove it
+    @param  context   Passed to the hook unchanged
+*/
+/**************************************************************************/
+void DFRNFC::setTraceHook(PN532TraceHook hook, void *context)
+{
+#ifdef PN532TRACE
+  _traceHook = hook;
+  _traceContext = context;
+  _traceCommand = 0;
+#else
+  (void)hook;
+  (void)context;
+#endif
+}
 
+#ifdef PN532TRACE
 /**************************************************************************/
 /*! 
-      Indicates whether the specified block number is the first block
-      in the sector (block 0 relative to the current sector)
+    @brief  Passes an event to the trace hook, if one is installed
 */
 /**************************************************************************/
-boolean DFRNFC::mifareclassic_IsFirstBlock (uint32_t uiBlock)
+void DFRNFC::trace(uint8_t type, const uint8_t *data, uint16_t len, const uint8_t *body, uint16_t bodylen)
 {
-  // Test if we are in the small or big sectors
-  if (uiBlock < 128)
-    return ((uiBlock) % 4 == 0);
-  else
-    return ((uiBlock) % 16 == 0);
+  if (!_traceHook)
+    return;
+
+  PN532TraceEvent event;
+  event.type = type;
+  event.command = _traceCommand;
+  event.error = _lastError;
+  event.micros = micros();
+  event.data = data;
+  event.len = len;
+  event.body = body;
+  event.bodylen = bodylen;
+  _traceHook(&event, _traceContext);
 }
+#endif
 
 /**************************************************************************/
 /*! 
-      Indicates whether the specified block number is the sector trailer
+    @brief  Wakes the PN532 from PowerDown with the HSU wake-up sequence
 */
 /**************************************************************************/
-boolean DFRNFC::mifareclassic_IsTrailerBlock (uint32_t uiBlock)
+void DFRNFC::wakeup(void)
 {
-  // Test if we are in the small or big sectors
-  if (uiBlock < 128)
-    return ((uiBlock + 1) % 4 == 0);
-  else
-    return ((uiBlock + 1) % 16 == 0);
+  _asleep = 0;
+  _powerStats.wakes++;
+  _powerStats.asleepMillis += millis() - _sleepStart;
+
+  memcpy_P(_frame, wakeDummy, sizeof(wakeDummy));
+  _serial->write(_frame, sizeof(wakeDummy));
+  delay(2);   // oscillator start-up
 }
 
+/***** Register Access ******/
+
 /**************************************************************************/
 /*! 
-    Tries to authenticate a block of memory on a MIFARE card using the
-    INDATAEXCHANGE command.  See section 7.3.8 of the PN532 User Manual
-    for more information on sending MIFARE and other commands.
+    @brief  Reads PN532 registers (SFR or XRAM addresses), packing as
+            many addresses into each ReadRegister frame as the packet
+            buffer holds: 31 per frame. A frame could carry 126, but
+            the addresses have to be turned big endian on the way and
+            a buffer for that would cost another 250 bytes of RAM, so
+            longer lists take a round trip per 31 registers instead
 
-    @param  uid           Pointer to a byte array containing the card UID
-    @param  uidLen        The length (in bytes) of the card's UID (Should
-                          be 4 for MIFARE Classic)
-    @param  blockNumber   The block number to authenticate.  (0..63 for
-                          1KB cards, and 0..255 for 4KB cards).
-    @param  keyNumber     Which key type to use during authentication
-                          (0 = MIFARE_CMD_AUTH_A, 1 = MIFARE_CMD_AUTH_B)
-    @param  keyData       Pointer to a byte array containing the 6 byte
-                          key value
+    @param  addresses Pointer to the register addresses (PN532_REG_*)
+    @param  values    Receives one value per address
+    @param  count     Number of registers
     
     @returns 1 if everything executed properly, 0 for an error
 */
 /**************************************************************************/
-uint8_t DFRNFC::mifareclassic_AuthenticateBlock (uint8_t * uid, uint8_t uidLen, uint32_t blockNumber, uint8_t keyNumber, uint8_t * keyData)
+boolean DFRNFC::readRegisters(const uint16_t *addresses, uint8_t *values, uint8_t count)
 {
-  uint8_t len;
-  uint8_t i;
-  
-  // Hang on to the key and uid data
-  memcpy (_key, keyData, 6); 
-  memcpy (_uid, uid, uidLen); 
-  uidLength = uidLen;  
+  const uint8_t perFrame = (PN532_PACKBUFFSIZ - 1) / 2;
 
-  #ifdef MIFAREDEBUG
-  _serial->print("Trying to authenticate card ");
-  DFRNFC::PrintHex(uid, uidLen);
-  _serial->print("Using authentication KEY ");_serial->print(keyNumber ? 'B' : 'A');_serial->print(": ");
-  DFRNFC::PrintHex(_key, 6);
-  #endif
-  
-  // Prepare the authentication command //
-  pn532_packetbuffer[0] = PN532_COMMAND_INDATAEXCHANGE;   /* Data Exchange Header */
-  pn532_packetbuffer[1] = 1;                              /* Max card numbers */
-  pn532_packetbuffer[2] = (keyNumber) ? MIFARE_CMD_AUTH_B : MIFARE_CMD_AUTH_A;
-  pn532_packetbuffer[3] = blockNumber;                    /* Block Number (1K = 0..63, 4K = 0..255 */
-  memcpy (pn532_packetbuffer+4, _key, 6);
-  for (i = 0; i < uidLength; i++)
+  for (uint8_t done = 0; done < count; )
   {
-    pn532_packetbuffer[10+i] = _uid[i];                /* 4 byte card ID */
-  }
+    uint8_t n = (count - done < perFrame) ? count - done : perFrame;
 
-  if (! sendCommandCheckAck(pn532_packetbuffer, 10+uidLength))
-    return 0;
+    pn532_packetbuffer[0] = PN532_COMMAND_READREGISTER;
+    for (uint8_t i = 0; i < n; i++)
+    {
+      pn532_packetbuffer[1+i*2] = addresses[done+i] >> 8;
+      pn532_packetbuffer[2+i*2] = addresses[done+i] & 0xFF;
+    }
+    if (!sendCommandCheckAck(pn532_packetbuffer, 1+n*2))
+      return 0;
 
-  // Read the response packet
-  readdata(pn532_packetbuffer, 10);
-  // check if the response is valid and we are authenticated???
-  // for an auth success it should be bytes 5-7: 0xD5 0x41 0x00
-  // Mifare auth error is technically byte 7: 0x14 but anything other and 0x00 is not good
-  if (pn532_packetbuffer[7] != 0x00)
-  {
-    #ifdef PN532DEBUG
-    _serial->print("Authentification failed: ");
-    DFRNFC::PrintHexChar(pn532_packetbuffer, 10);
-    #endif
-    return 0;
+    // the values come back in request order
+    if (readframe(PN532_COMMAND_READREGISTER, values+done, n) != n)
+      return 0;
+    done += n;
   }
 
   return 1;
@@ -315,739 +507,3766 @@ uint8_t DFRNFC::mifareclassic_AuthenticateBlock (uint8_t * uid, uint8_t uidLen,
 
 /**************************************************************************/
 /*! 
-    Tries to read an entire 16-byte data block at the specified block
-    address.
+    @brief  Writes PN532 registers, packing as many address/value pairs
+            into each WriteRegister frame as the packet buffer holds:
+            21 per frame, for the same reason as in readRegisters
 
-    @param  blockNumber   The block number to authenticate.  (0..63 for
-                          1KB cards, and 0..255 for 4KB cards).
-    @param  data          Pointer to the byte array that will hold the
-                          retrieved data (if any)
+    @param  addresses Pointer to the register addresses (PN532_REG_*)
+    @param  values    One value per address
+    @param  count     Number of registers
     
     @returns 1 if everything executed properly, 0 for an error
 */
 /**************************************************************************/
-uint8_t DFRNFC::mifareclassic_ReadDataBlock (uint8_t blockNumber, uint8_t * data)
+boolean DFRNFC::writeRegisters(const uint16_t *addresses, const uint8_t *values, uint8_t count)
 {
-  #ifdef MIFAREDEBUG
-  _serial->print("Trying to read 16 bytes from block ");_serial->println(blockNumber);
-  #endif
-  
-  /* Prepare the command */
-  pn532_packetbuffer[0] = PN532_COMMAND_INDATAEXCHANGE;
-  pn532_packetbuffer[1] = 1;                      /* Card number */
-  pn532_packetbuffer[2] = MIFARE_CMD_READ;        /* Mifare Read command = 0x30 */
-  pn532_packetbuffer[3] = blockNumber;            /* Block Number (0..63 for 1K, 0..255 for 4K) */
+  const uint8_t perFrame = (PN532_PACKBUFFSIZ - 1) / 3;
 
-  /* Send the command */
-  if (! sendCommandCheckAck(pn532_packetbuffer, 4))
+  for (uint8_t done = 0; done < count; )
   {
-    #ifdef MIFAREDEBUG
-    _serial->println("Failed to receive ACK for read command");
-    #endif
-    return 0;
-  }
-
-  /* Read the response packet */
-  readdata(pn532_packetbuffer, 26);
+    uint8_t n = (count - done < perFrame) ? count - done : perFrame;
 
-  /* If byte 8 isn't 0x00 we probably have an error */
-  if (pn532_packetbuffer[7] != 0x00)
-  {
-    #ifdef MIFAREDEBUG
-        _serial->println("Unexpected response");
-        DFRNFC::PrintHexChar(pn532_packetbuffer, 26);
-    #endif
-    return 0;
+    pn532_packetbuffer[0] = PN532_COMMAND_WRITEREGISTER;
+    for (uint8_t i = 0; i < n; i++)
+    {
+      pn532_packetbuffer[1+i*3] = addresses[done+i] >> 8;
+      pn532_packetbuffer[2+i*3] = addresses[done+i] & 0xFF;
+      pn532_packetbuffer[3+i*3] = values[done+i];
+    }
+    if (!sendCommandCheckAck(pn532_packetbuffer, 1+n*3))
+      return 0;
+    if (readframe(PN532_COMMAND_WRITEREGISTER, pn532_packetbuffer, PN532_PACKBUFFSIZ) < 0)
+      return 0;
+    done += n;
   }
-    
-  /* Copy the 16 data bytes to the output buffer        */
-  /* Block content starts at byte 9 of a valid response */
-  memcpy (data, pn532_packetbuffer+8, 16);
 
-  /* Display data for debug if requested */
-  #ifdef MIFAREDEBUG
-    _serial->print("Block ");
-    _serial->println(blockNumber);
-    DFRNFC::PrintHexChar(data, 16);
-  #endif
-
-  return 1;  
+  return 1;
 }
 
 /**************************************************************************/
 /*! 
-    Tries to write an entire 16-byte data block at the specified block
-    address.
+    @brief  Read-modify-write of several registers: one batched read,
+            then one batched write of only the registers whose value
+            actually changes
 
-    @param  blockNumber   The block number to authenticate.  (0..63 for
-                          1KB cards, and 0..255 for 4KB cards).
-    @param  data          The byte array that contains the data to write.
+    @param  addresses Pointer to the register addresses (PN532_REG_*)
+    @param  masks     Bits to change in each register
+    @param  values    New values of the masked bits
+    @param  count     Number of registers (up to PN532_PACKBUFFSIZ / 3
+                      are updated with two frames)
     
     @returns 1 if everything executed properly, 0 for an error
 */
 /**************************************************************************/
-uint8_t DFRNFC::mifareclassic_WriteDataBlock (uint8_t blockNumber, uint8_t * data)
+boolean DFRNFC::updateRegisters(const uint16_t *addresses, const uint8_t *masks, const uint8_t *values, uint8_t count)
 {
-  #ifdef MIFAREDEBUG
-  _serial->print("Trying to write 16 bytes to block ");_serial->println(blockNumber);
-  #endif
-  
-  /* Prepare the first command */
-  pn532_packetbuffer[0] = PN532_COMMAND_INDATAEXCHANGE;
-  pn532_packetbuffer[1] = 1;                      /* Card number */
-  pn532_packetbuffer[2] = MIFARE_CMD_WRITE;       /* Mifare Write command = 0xA0 */
-  pn532_packetbuffer[3] = blockNumber;            /* Block Number (0..63 for 1K, 0..255 for 4K) */
-  memcpy (pn532_packetbuffer+4, data, 16);          /* Data Payload */
+  const uint8_t perFrame = PN532_PACKBUFFSIZ / 3;
+  uint16_t changedAddresses[perFrame];
+  uint8_t current[perFrame];
+  uint8_t n;
 
-  /* Send the command */
-  if (! sendCommandCheckAck(pn532_packetbuffer, 20))
+  for (uint8_t done = 0; done < count; done += n)
   {
-    #ifdef MIFAREDEBUG
-    _serial->println("Failed to receive ACK for write command");
-    #endif
-    return 0;
-  }  
-    delay(2);
-  /* Read the response packet */
-  readdata(pn532_packetbuffer, 10);
+    n = (count - done < perFrame) ? count - done : perFrame;
 
+    if (!readRegisters(addresses+done, current, n))
+      return 0;
 
-  return 1;  
+    uint8_t changed = 0;
+    for (uint8_t i = 0; i < n; i++)
+    {
+      uint8_t value = (current[i] & ~masks[done+i]) | (values[done+i] & masks[done+i]);
+      if (value != current[i])
+      {
+        changedAddresses[changed] = addresses[done+i];
+        current[changed] = value;
+        changed++;
+      }
+    }
+    if (changed && !writeRegisters(changedAddresses, current, changed))
+      return 0;
+  }
+
+  return 1;
 }
 
+/***** RF Configuration ******/
+
 /**************************************************************************/
 /*! 
-    Formats a Mifare Classic card to store NDEF Records 
+    @brief  Sends an RFConfiguration command and waits for its response
+
+    @param  cfgItem   The configuration item (PN532_RFCFG_*)
+    @param  cfgData   The item's data
+    @param  len       Length of the data
     
     @returns 1 if everything executed properly, 0 for an error
 */
 /**************************************************************************/
-uint8_t DFRNFC::mifareclassic_FormatNDEF (void)
+boolean DFRNFC::rfConfiguration(uint8_t cfgItem, const uint8_t *cfgData, uint8_t len)
 {
-  uint8_t sectorbuffer1[16] = {0x14, 0x01, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1};
-  uint8_t sectorbuffer2[16] = {0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1};
-  uint8_t sectorbuffer3[16] = {0xA0, 0xA1, 0xA2, 0xA3, 0xA4, 0xA5, 0x78, 0x77, 0x88, 0xC1, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+  pn532_packetbuffer[0] = PN532_COMMAND_RFCONFIGURATION;
+  pn532_packetbuffer[1] = cfgItem;
 
-  // Write block 1 and 2 to the card
-  if (!(mifareclassic_WriteDataBlock (1, sectorbuffer1)))
-    return 0;
-  if (!(mifareclassic_WriteDataBlock (2, sectorbuffer2)))
-    return 0;
-  // Write key A and access rights card
-  if (!(mifareclassic_WriteDataBlock (3, sectorbuffer3)))
+  if (!sendCommandCheckAck(pn532_packetbuffer, 2, cfgData, len))
     return 0;
 
-  // Seems that everything was OK (?!)
-  return 1;
+  return (readframe(PN532_COMMAND_RFCONFIGURATION, pn532_packetbuffer, PN532_PACKBUFFSIZ) == 0);
 }
 
 /**************************************************************************/
 /*! 
-    Writes an NDEF URI Record to the specified sector (1..15)
-    
-    Note that this function assumes that the Mifare Classic card is
-    already formatted to work as an "NFC Forum Tag" and uses a MAD1
-    file system.  You can use the NXP TagWriter app on Android to
-    properly format cards for this.
+    @brief  Switches the RF field. Turning it off between polls saves
+            most of the reader's power.
 
-    @param  sectorNumber  The sector that the URI record should be written
-                          to (can be 1..15 for a 1K card)
-    @param  uriIdentifier The uri identifier code (0 = none, 0x01 = 
-                          "http://www.", etc.)
-    @param  url           The uri text to write (max 38 characters).
-    
-    @returns 1 if everything executed properly, 0 for an error
+    @param  rfOn      1 to switch the field on
+    @param  autoRFCA  1 to do RF collision avoidance before switching on
 */
 /**************************************************************************/
-uint8_t DFRNFC::mifareclassic_WriteNDEFURI (uint8_t sectorNumber, uint8_t uriIdentifier, const char * url)
+boolean DFRNFC::setRFField(boolean rfOn, boolean autoRFCA)
 {
-  // Figure out how long the string is
-  uint8_t len = strlen(url);
-  
-  // Make sure we're within a 1K limit for the sector number
-  if ((sectorNumber < 1) || (sectorNumber > 15))
-    return 0;
-  
-  // Make sure the URI payload is between 1 and 38 chars
-  if ((len < 1) || (len > 38))
-    return 0;
-    
-  // Setup the sector buffer (w/pre-formatted TLV wrapper and NDEF message)
-  uint8_t sectorbuffer1[16] = {0x00, 0x00, 0x03, len+5, 0xD1, 0x01, len+1, 0x55, uriIdentifier, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
-  uint8_t sectorbuffer2[16] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
-  uint8_t sectorbuffer3[16] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
-  uint8_t sectorbuffer4[16] = {0xD3, 0xF7, 0xD3, 0xF7, 0xD3, 0xF7, 0x7F, 0x07, 0x88, 0x40, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+  uint8_t cfg = (autoRFCA ? 0x02 : 0x00) | (rfOn ? 0x01 : 0x00);
+  return rfConfiguration(PN532_RFCFG_FIELD, &cfg, 1);
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Sets the timeouts for the ATR_RES of an NFC-DEP target and
+            for the answer of a target during InCommunicateThru and
+            InDataExchange retries
+
+    @param  atrResTimeout   PN532_RFTIMEOUT_* code, default 102.4 ms
+    @param  retryTimeout    PN532_RFTIMEOUT_* code, default 51.2 ms
+*/
+/**************************************************************************/
+boolean DFRNFC::setRFTimeouts(uint8_t atrResTimeout, uint8_t retryTimeout)
+{
+  uint8_t cfg[3] = {0x00, atrResTimeout, retryTimeout};  // first byte is RFU
+  return rfConfiguration(PN532_RFCFG_TIMINGS, cfg, 3);
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Sets how often InCommunicateThru and InDataExchange are
+            retried when the target does not answer (default 0)
+*/
+/**************************************************************************/
+boolean DFRNFC::setMaxRetryCOM(uint8_t maxRetryCOM)
+{
+  return rfConfiguration(PN532_RFCFG_MAXRETRYCOM, &maxRetryCOM, 1);
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Sets the retry counts of the activation commands, 0xFF
+            retries forever
+
+    @param  maxRetryATR               ATR_REQ retries (default 0xFF)
+    @param  maxRetryPSL               PSL_REQ retries (default 0x01)
+    @param  maxRetryPassiveActivation InListPassiveTarget retries
+                                      (default 0xFF)
+*/
+/**************************************************************************/
+boolean DFRNFC::setMaxRetries(uint8_t maxRetryATR, uint8_t maxRetryPSL, uint8_t maxRetryPassiveActivation)
+{
+  uint8_t cfg[3] = {maxRetryATR, maxRetryPSL, maxRetryPassiveActivation};
+  return rfConfiguration(PN532_RFCFG_MAXRETRIES, cfg, 3);
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Loads the analog settings for 106 kbps type A (receiver
+            gain, conductances, modulation width, ...)
+*/
+/**************************************************************************/
+boolean DFRNFC::setAnalogSettingsTypeA(const PN532AnalogTypeA *settings)
+{
+  return rfConfiguration(PN532_RFCFG_ANALOG_106A, (const uint8_t *)settings, sizeof(PN532AnalogTypeA));
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Measures how long readPassiveTargetID takes to find the card
+            in the field with the current configuration
+
+    @param  samples   Number of detections to average over
+    
+    @returns  Average latency in microseconds of the successful
+              detections, 0xFFFFFFFF if the card was never found
+*/
+/**************************************************************************/
+uint32_t DFRNFC::measureDetectionLatency(uint8_t samples)
+{
+  uint32_t total = 0;
+  uint8_t found = 0;
+  uint8_t uid[7];
+  uint8_t len;
+
+  for (uint8_t i = 0; i < samples; i++)
+  {
+    unsigned long start = micros();
+    if (readPassiveTargetID(PN532_MIFARE_ISO14443A, uid, &len))
+    {
+      total += micros() - start;
+      found++;
+    }
+  }
+
+  return found ? total / found : 0xFFFFFFFF;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Measures the detection latency for a series of
+            MxRtyPassiveActivation settings, to trade detection speed
+            against RF on-time. The last setting stays active.
+
+    @param  retries   The MxRtyPassiveActivation values to try
+    @param  count     Number of values
+    @param  samples   Detections per value
+    @param  latency   Receives the average latency per value in
+                      microseconds, see measureDetectionLatency
+*/
+/**************************************************************************/
+void DFRNFC::sweepDetectionLatency(const uint8_t *retries, uint8_t count, uint8_t samples, uint32_t *latency)
+{
+  for (uint8_t i = 0; i < count; i++)
+  {
+    if (!setPassiveActivationRetries(retries[i]))
+      latency[i] = 0xFFFFFFFF;
+    else
+      latency[i] = measureDetectionLatency(samples);
+  }
+}
+
+/***** Target Mode Commands ******/
+
+/**************************************************************************/
+/*! 
+    @brief  Init PN532 as a NFC-DEP target (passive 106 kbps, FeliCa
+            212/424 kbps) advertising LLCP in its general bytes, so a
+            phone can start a peer to peer exchange with it
+
+    @param  timeout   max time in ms to wait for an initiator, 0 means
+                      no timeout
+    
+    @returns  > 0 success, = 0 timeout, < 0 failed
+*/
+/**************************************************************************/
+int8_t DFRNFC::tgInitAsTarget(uint16_t timeout)
+{
+  const uint8_t command[] = {
+    PN532_COMMAND_TGINITASTARGET,
+    0x00,                                           // Mode: any
+    0x00, 0x00,                                     // SENS_RES
+    0x00, 0x00, 0x00,                               // NFCID1
+    0x40,                                           // SEL_RES: DEP supported
+    0x01, 0xFE, 0x0F, 0xBB, 0xBA, 0xA6, 0xC9, 0x89, // POL_RES: NFCID2t
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, //          PAD
+    0xFF, 0xFF,                                     //          system code
+    0x01, 0xFE, 0x0F, 0xBB, 0xBA, 0xA6, 0xC9, 0x89, 0x00, 0x00, // NFCID3t
+    0x06, 0x46, 0x66, 0x6D, 0x01, 0x01, 0x10,       // general bytes: LLCP magic and version
+    0x00                                            // no historical bytes
+  };
+
+  return tgInitAsTarget(command, sizeof(command), timeout);
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Init PN532 as a target with a complete TgInitAsTarget command
+
+    @param  command   The command, starting with PN532_COMMAND_TGINITASTARGET
+    @param  len       Length of the command
+    @param  timeout   max time in ms to wait for an initiator, 0 means
+                      no timeout
+    
+    @returns  > 0 success, = 0 timeout, < 0 failed
+*/
+/**************************************************************************/
+int8_t DFRNFC::tgInitAsTarget(const uint8_t* command, const uint8_t len, const uint16_t timeout)
+{
+  if (!sendCommandCheckAck(pn532_packetbuffer, 0, command, len))
+    return -1;
+
+  // The response only comes once an initiator has activated us
+  if (!waitavailable(timeout))
+  {
+    memcpy_P(_frame, pn532ack, sizeof(pn532ack));
+    _serial->write(_frame, sizeof(pn532ack));   // an ACK frame aborts the pending command
+    return 0;
+  }
+
+  // Mode byte followed by the initiator's activation command
+  if (readframe(PN532_COMMAND_TGINITASTARGET, pn532_packetbuffer, PN532_PACKBUFFSIZ) < 1)
+    return -1;
+
+  return 1;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Receives the data the initiator sent to us as a target
+
+    @param  buf       Receives the data
+    @param  len       Size of buf
+    @param  timeout   max time in ms to wait for the initiator, 0 means
+                      no timeout
+    
+    @returns  Number of bytes received, -1 if the PN532 did not answer,
+              -2 if it reported an error, -3 if the data did not fit,
+              -4 if nothing came within the timeout
+*/
+/**************************************************************************/
+int16_t DFRNFC::tgGetData(uint8_t *buf, uint8_t len, uint16_t timeout)
+{
+  uint8_t status;
+  int16_t n;
+
+  pn532_packetbuffer[0] = PN532_COMMAND_TGGETDATA;
+  if (!sendCommandCheckAck(pn532_packetbuffer, 1))
+    return -1;
+
+  // The response only comes once the initiator has sent something
+  if (!waitavailable(timeout))
+  {
+    memcpy_P(_frame, pn532ack, sizeof(pn532ack));
+    _serial->write(_frame, sizeof(pn532ack));   // an ACK frame aborts the pending command
+    return -4;
+  }
+
+  n = readframe(PN532_COMMAND_TGGETDATA, &status, 1, buf, len);
+  if (n == -2)
+    return -3;
+  if (n < 1)
+    return -1;
+  if (!checkstatus(status))
+    return -2;
+
+  return n - 1;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Sends data to the initiator as a response to its last frame
+
+    @param  header    Pointer to the first part of the data
+    @param  hlen      Length of header (up to 63 bytes)
+    @param  body      Optional second part, sent from the caller's buffer
+    @param  blen      Length of body, hlen + blen is at most 253 so the
+                      command fits a normal frame
+    
+    @returns 1 if everything executed properly, 0 for an error
+*/
+/**************************************************************************/
+boolean DFRNFC::tgSetData(const uint8_t *header, uint8_t hlen, const uint8_t *body, uint8_t blen)
+{
+  if ((hlen > PN532_PACKBUFFSIZ - 1) || (1 + hlen + blen > 254))
+  {
+    _lastError = PN532_ERROR_RANGE;
+    return 0;
+  }
+
+  pn532_packetbuffer[0] = PN532_COMMAND_TGSETDATA;
+  memcpy (pn532_packetbuffer+1, header, hlen);
+  if (!sendCommandCheckAck(pn532_packetbuffer, 1+hlen, body, blen))
+    return 0;
+
+  if (readframe(PN532_COMMAND_TGSETDATA, pn532_packetbuffer, 1) < 1)
+    return 0;
+
+  return checkstatus(pn532_packetbuffer[0]);
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Releases the target(s) selected as initiator
+
+    @param  relevantTarget  Logical target number, 0 releases all
+    
+    @returns  The PN532 status byte (0 for success), -1 if the PN532
+              did not answer
+*/
+/**************************************************************************/
+int16_t DFRNFC::inRelease(const uint8_t relevantTarget)
+{
+  pn532_packetbuffer[0] = PN532_COMMAND_INRELEASE;
+  pn532_packetbuffer[1] = relevantTarget;
+  if (!sendCommandCheckAck(pn532_packetbuffer, 2))
+    return -1;
+
+  if (readframe(PN532_COMMAND_INRELEASE, pn532_packetbuffer, 1) < 1)
+    return -1;
+
+  fS50found = 0;
+  return pn532_packetbuffer[0] & 0x3F;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Checks whether the card of the current session is still in
+            the field with a single InListPassiveTarget, which shows
+            which card answers. The card is selected again, so it has to
+            be authenticated again
+
+    @returns  PN532_SESSION_SAME if the card of the session answered,
+              PN532_SESSION_NEW if another card started a new session,
+              and PN532_SESSION_NONE if no card answered
+*/
+/**************************************************************************/
+uint8_t DFRNFC::checkSession(void)
+{
+  uint16_t generation = _generation;
+
+  if (!readPassiveTargetID(PN532_MIFARE_ISO14443A, _uid, &uidLength))
+  {
+    fS50found = 0;
+    return PN532_SESSION_NONE;
+  }
+  return (generation == _generation) ? PN532_SESSION_SAME : PN532_SESSION_NEW;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Selects a listed target again, e.g. after a failed Mifare
+            authentication halted it
+
+    @param  relevantTarget  Logical target number
+    
+    @returns  1 if the target answered
+*/
+/**************************************************************************/
+boolean DFRNFC::inSelect(const uint8_t relevantTarget)
+{
+  _authSector = PN532_NOSECTOR;
+  pn532_packetbuffer[0] = PN532_COMMAND_INSELECT;
+  pn532_packetbuffer[1] = relevantTarget;
+  if (!sendCommandCheckAck(pn532_packetbuffer, 2))
+    return 0;
+
+  if (readframe(PN532_COMMAND_INSELECT, pn532_packetbuffer, 1) < 1)
+    return 0;
+
+  return checkstatus(pn532_packetbuffer[0]);
+}
+
+
+/***** ISO14443A Commands ******/
+
+/**************************************************************************/
+/*! 
+    Waits for an ISO14443A target to enter the field. FeliCa and type B
+    cards answer with a different record layout, use felica_Poll and
+    iso14443b_Poll for them.
+    
+    @param  cardBaudRate  Baud rate of the card, must be
+                          PN532_MIFARE_ISO14443A
+    @param  uid           Pointer to the array that will be populated
+                          with the card's UID (up to 7 bytes)
+    @param  uidLength     Pointer to the variable that will hold the
+                          length of the card's UID.
+    
+    @returns 1 if everything executed properly, 0 for an error
+*/
+/**************************************************************************/
+boolean DFRNFC::readPassiveTargetID(uint8_t cardbaudrate, uint8_t * uid, uint8_t * uidLength) {
+  if (cardbaudrate != PN532_MIFARE_ISO14443A)
+  {
+    _lastError = PN532_ERROR_RANGE;
+    return 0;
+  }
+
+  _authSector = PN532_NOSECTOR;   // listing selects the card again
+
+  // max 1 cards at once (we can set this to 2 later), prebuilt
+  if (!sendcheckack(frameListTarget, 0, 0, 0, 0))
+    return 0x0;  // no cards read
+  
+  // read data packet
+  int16_t n = readframe(PN532_COMMAND_INLISTPASSIVETARGET, pn532_packetbuffer, PN532_PACKBUFFSIZ);
+  if (n < 1)
+    return 0;
+
+  /* ISO14443A card response should be in the following format:
+  
+    byte            Description
+    -------------   ------------------------------------------
+    b0              Tags Found
+    b1              Tag Number (only one used in this example)
+    b2..3           SENS_RES
+    b4              SEL_RES
+    b5              NFCID Length
+    b6..NFCIDLen    NFCID                                      */
+  
+  if (pn532_packetbuffer[0] != 1) 
+  {
+    _lastError = PN532_ERROR_NOCARD;
+    return 0;
+  }
+  if ((n < 6) || (pn532_packetbuffer[5] > 7) || (n < 6 + pn532_packetbuffer[5]))
+  {
+    _lastError = PN532_ERROR_FRAME;
+    return 0;
+  }
+
+  /* A new session starts unless this is the card of the running one */
+  if (!fS50found || (this->uidLength != pn532_packetbuffer[5]) || memcmp(_uid, pn532_packetbuffer+6, this->uidLength))
+    _generation++;
+
+  /* SEL_RES tells Mifare Classic 1K/4K from Type 2 Tags */
+  _selRes = pn532_packetbuffer[4];
+  this->uidLength = *uidLength = pn532_packetbuffer[5];
+  for (uint8_t i=0; i < pn532_packetbuffer[5]; i++) 
+  {
+    uid[i] = pn532_packetbuffer[6+i];
+    _uid[i] = pn532_packetbuffer[6+i];
+  }
+    
+  fS50found = 1;
+  _cardContact = millis();
+  return 1;
+}
+
+
+/***** Raw Frame Functions ******/
+
+/**************************************************************************/
+/*! 
+    Sends a raw frame to the target with InCommunicateThru, bypassing
+    the PN532's protocol handling, so vendor commands the PN532 does not
+    know can be used. CRC and parity are added and checked according to
+    setCRC/setParity (both on after readPassiveTargetID). The answer is
+    received straight into the caller's buffer.
+
+    @param  data          Pointer to the frame to send
+    @param  len           Length of the frame
+    @param  response      Receives the target's answer
+    @param  responseSize  Size of response
+    
+    @returns  Length of the answer, -1 if the PN532 did not answer,
+              -2 if it reported an error (timeout, CRC, parity, ...),
+              -3 if the frame is longer than 253 bytes or the answer
+              did not fit
+*/
+/**************************************************************************/
+int16_t DFRNFC::inCommunicateThru(const uint8_t *data, uint8_t len, uint8_t *response, uint8_t responseSize)
+{
+  uint8_t header = PN532_COMMAND_INCOMMUNICATETHRU;
+  uint8_t status;
+
+  if (len > 253)
+  {
+    _lastError = PN532_ERROR_RANGE;
+    return -3;
+  }
+
+  if (!sendCommandCheckAck(&header, 1, data, len))
+    return -1;
+
+  int16_t n = readframe(PN532_COMMAND_INCOMMUNICATETHRU, &status, 1, response, responseSize);
+  if (n == -2)
+    return -3;
+  if (n < 1)
+    return -1;
+  if (!checkstatus(status))
+    return -2;
+
+  return n - 1;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Switches the CRC generation for sent frames and the CRC
+            check for received frames (TxCRCEn/RxCRCEn of the CIU)
+*/
+/**************************************************************************/
+boolean DFRNFC::setCRC(boolean txCRC, boolean rxCRC)
+{
+  const uint16_t addresses[2] = {PN532_REG_CIU_TXMODE, PN532_REG_CIU_RXMODE};
+  const uint8_t masks[2] = {0x80, 0x80};
+  uint8_t values[2] = {(uint8_t)(txCRC ? 0x80 : 0x00), (uint8_t)(rxCRC ? 0x80 : 0x00)};
+
+  return updateRegisters(addresses, masks, values, 2);
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Switches parity generation and checking (ParityDisable of the
+            CIU ManualRcv register)
+*/
+/**************************************************************************/
+boolean DFRNFC::setParity(boolean enable)
+{
+  const uint16_t address = PN532_REG_CIU_MANUALRCV;
+  const uint8_t mask = 0x10;
+  uint8_t value = enable ? 0x00 : 0x10;
+
+  return updateRegisters(&address, &mask, &value, 1);
+}
+
+
+/***** ISO14443-4 Functions ******/
+
+/**************************************************************************/
+/*! 
+    Exchanges data with an activated target through InDataExchange.
+    Data that exceeds one frame is chained with the PN532 "more
+    information" flag in both directions, and is sent and received
+    straight from and into the caller's buffers.
+
+    @param  tg            The logical target number
+    @param  out           Pointer to the data to send
+    @param  outLen        Length of the data to send
+    @param  in            Receives the response data
+    @param  inSize        Size of in
+    
+    @returns  Length of the response,
+              -1 if the PN532 did not answer or sent a malformed frame,
+              -2 if the PN532 reported an error,
+              -3 if the response did not fit
+*/
+/**************************************************************************/
+int32_t DFRNFC::indataexchange(uint8_t tg, const uint8_t *out, uint16_t outLen, uint8_t *in, uint16_t inSize)
+{
+  uint8_t header[2];
+  uint8_t status = 0;
+  uint16_t sent = 0;
+  uint16_t received = 0;
+  int16_t n;
+
+  header[0] = PN532_COMMAND_INDATAEXCHANGE;
+
+  // Send the data, every frame but the last one has MI set
+  do
+  {
+    uint16_t chunk = outLen - sent;
+    if (chunk > PN532_INDATAEXCHANGE_MAXLEN)
+      chunk = PN532_INDATAEXCHANGE_MAXLEN;
+    header[1] = (sent + chunk < outLen) ? (tg | PN532_MI) : tg;
+
+    if (!sendCommandCheckAck(header, 2, out+sent, chunk))
+      return -1;
+    sent += chunk;
+
+    n = readframe(PN532_COMMAND_INDATAEXCHANGE, &status, 1, in, inSize);
+    if (n == -2)
+      return -3;
+    if (n < 1)
+      return -1;
+    if (!checkstatus(status))
+      return -2;
+  } while (sent < outLen);
+  received = n - 1;
+
+  // Collect the rest of a chained response
+  while (status & PN532_MI)
+  {
+    header[1] = tg;
+    if (!sendCommandCheckAck(header, 2))
+      return -1;
+    n = readframe(PN532_COMMAND_INDATAEXCHANGE, &status, 1, in+received, inSize-received);
+    if (n == -2)
+      return -3;
+    if (n < 1)
+      return -1;
+    if (!checkstatus(status))
+      return -2;
+    received += n - 1;
+  }
+
+  return received;
+}
+
+/**************************************************************************/
+/*! 
+    Exchanges an APDU with the ISO-DEP target activated by
+    readPassiveTargetID (DESFire, Type 4 Tags, ...). The PN532 handles
+    the ISO14443-4 block chaining, larger APDUs and responses are
+    chained by indataexchange.
+
+    @param  apdu          Pointer to the command APDU
+    @param  apduLen       Length of the command APDU
+    @param  response      Receives the response data followed by SW1 SW2
+    @param  responseSize  Size of response, including 2 bytes for SW
+    @param  sw            Set to the status word (SW1 << 8 | SW2)
+    
+    @returns  Length of the response data without SW,
+              -1 if the PN532 did not answer or sent a malformed frame,
+              -2 if the PN532 reported an error,
+              -3 if the response did not fit or lacked a status word
+*/
+/**************************************************************************/
+int16_t DFRNFC::transceiveAPDU(const uint8_t *apdu, uint16_t apduLen, uint8_t *response, uint16_t responseSize, uint16_t *sw)
+{
+  int32_t received = indataexchange(1, apdu, apduLen, response, responseSize);
+
+  if (received < 0)
+    return received;
+  if (received < 2)
+    return -3;
+  received -= 2;
+  *sw = ((uint16_t)response[received] << 8) | response[received+1];
+  return received;
+}
+
+
+/***** NFC-DEP Initiator Functions ******/
+
+/**************************************************************************/
+/*! 
+    Activates an NFC-DEP target (a phone or a PN532 in target mode) in
+    passive mode at 106 kbps, then raises the bit rate with InPSL, trying
+    maxBaudrate first and stepping down to 212 kbps. The link stays at
+    106 kbps if the target refuses both.
+
+    @param  maxBaudrate   Highest bit rate to try, PN532_BAUDRATE_106K,
+                          PN532_BAUDRATE_212K or PN532_BAUDRATE_424K
+    
+    @returns  The bit rate in use (PN532_BAUDRATE_*), -1 if no target
+              was activated
+*/
+/**************************************************************************/
+int8_t DFRNFC::inJumpForDEP(uint8_t maxBaudrate)
+{
+  pn532_packetbuffer[0] = PN532_COMMAND_INJUMPFORDEP;
+  pn532_packetbuffer[1] = 0x00;                   /* Passive mode */
+  pn532_packetbuffer[2] = PN532_BAUDRATE_106K;
+  pn532_packetbuffer[3] = 0x00;                   /* No optional fields */
+  if (!sendCommandCheckAck(pn532_packetbuffer, 4))
+    return -1;
+
+  /* Status, Tg, NFCID3t, DIDt, BSt, BRt, TO, PPt, Gt */
+  if (readframe(PN532_COMMAND_INJUMPFORDEP, pn532_packetbuffer, PN532_PACKBUFFSIZ) < 2)
+    return -1;
+  if (!checkstatus(pn532_packetbuffer[0]))
+    return -1;
+
+  _depTarget = pn532_packetbuffer[1];
+  _depBaudrate = PN532_BAUDRATE_106K;
+
+  for (uint8_t br = maxBaudrate; br > PN532_BAUDRATE_106K; br--)
+  {
+    pn532_packetbuffer[0] = PN532_COMMAND_INPSL;
+    pn532_packetbuffer[1] = _depTarget;
+    pn532_packetbuffer[2] = br;                   /* initiator to target */
+    pn532_packetbuffer[3] = br;                   /* target to initiator */
+    if (!sendCommandCheckAck(pn532_packetbuffer, 4))
+      return -1;
+    if (readframe(PN532_COMMAND_INPSL, pn532_packetbuffer, 1) < 1)
+      return -1;
+    if ((pn532_packetbuffer[0] & 0x3F) == 0x00)
+    {
+      _depBaudrate = br;
+      break;
+    }
+  }
+
+  return _depBaudrate;
+}
+
+/**************************************************************************/
+/*! 
+    Sends data to the NFC-DEP target activated by inJumpForDEP and
+    receives its answer, chaining frames for payloads of any size. The
+    transfer rate of the exchange is available from depThroughput().
+
+    @param  out           Pointer to the data to send
+    @param  outLen        Length of the data to send
+    @param  in            Receives the target's answer
+    @param  inSize        Size of in
+    
+    @returns  Length of the answer, < 0 as for indataexchange
+*/
+/**************************************************************************/
+int32_t DFRNFC::depTransceive(const uint8_t *out, uint16_t outLen, uint8_t *in, uint16_t inSize)
+{
+  unsigned long start = micros();
+  int32_t received = indataexchange(_depTarget, out, outLen, in, inSize);
+
+  _depMicros = micros() - start;
+  _depBytes = outLen + ((received > 0) ? received : 0);
+  return received;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Effective transfer rate of the last depTransceive, counting
+            the bytes sent and received
+
+    @returns  Bytes per second, 0 before the first exchange
+*/
+/**************************************************************************/
+uint32_t DFRNFC::depThroughput(void)
+{
+  // 15625 * 64 = 1000000, keeps the product in 32 bits for any transfer
+  if (_depMicros < 64)
+    return 0;
+  return (_depBytes * 15625UL) / (_depMicros / 64);
+}
+
+
+/***** FeliCa Functions ******/
+
+/**************************************************************************/
+/*! 
+    Waits for a FeliCa card to enter the field and reads its IDm/PMm.
+    The IDm is kept for felica_ReadWithoutEncryption.
+
+    @param  cardbaudrate  PN532_FELICA_212 or PN532_FELICA_424
+    @param  systemCode    System code to poll for, 0xFFFF for any
+    @param  idm           Receives the 8 byte IDm
+    @param  pmm           Receives the 8 byte PMm
+    
+    @returns 1 if a card was found, 0 otherwise
+*/
+/**************************************************************************/
+boolean DFRNFC::felica_Poll(uint8_t cardbaudrate, uint16_t systemCode, uint8_t * idm, uint8_t * pmm)
+{
+  if ((cardbaudrate != PN532_FELICA_212) && (cardbaudrate != PN532_FELICA_424))
+    return 0;
+
+  pn532_packetbuffer[0] = PN532_COMMAND_INLISTPASSIVETARGET;
+  pn532_packetbuffer[1] = 1;
+  pn532_packetbuffer[2] = cardbaudrate;
+  pn532_packetbuffer[3] = FELICA_CMD_POLLING;
+  pn532_packetbuffer[4] = systemCode >> 8;
+  pn532_packetbuffer[5] = systemCode & 0xFF;
+  pn532_packetbuffer[6] = 0x00;               /* Request code: none */
+  pn532_packetbuffer[7] = 0x00;               /* Time slot: 1 */
+  
+  if (!sendCommandCheckAck(pn532_packetbuffer, 8))
+    return 0;
+
+  /* byte    Description
+     ------  ------------------------------------------
+     b0      Tags Found
+     b1      Tag Number
+     b2      POL_RES length
+     b3      Response code (0x01)
+     b4..11  IDm
+     b12..19 PMm                                        */
+  int16_t n = readframe(PN532_COMMAND_INLISTPASSIVETARGET, pn532_packetbuffer, PN532_PACKBUFFSIZ);
+  if (n < 1)
+    return 0;
+  if (pn532_packetbuffer[0] != 1)
+  {
+    _lastError = PN532_ERROR_NOCARD;
+    return 0;
+  }
+  if ((n < 20) || (pn532_packetbuffer[3] != 0x01))
+  {
+    _lastError = PN532_ERROR_FRAME;
+    return 0;
+  }
+
+  memcpy (_idm, pn532_packetbuffer+4, 8);
+  memcpy (idm, pn532_packetbuffer+4, 8);
+  memcpy (pmm, pn532_packetbuffer+12, 8);
+  return 1;
+}
+
+/**************************************************************************/
+/*! 
+    Reads several blocks of the card found by felica_Poll with a single
+    Read Without Encryption command, i.e. one RF round trip. The block
+    data is received straight into the caller's buffer.
+
+    @param  numService    Number of service codes (1..16)
+    @param  serviceCodes  The service codes
+    @param  numBlock      Number of blocks (1..FELICA_READ_MAXBLOCKS = 14,
+                          15 would need an extended frame from the PN532)
+    @param  blockList     Block list, the high byte of each element is
+                          the index into serviceCodes, the low byte the
+                          block number
+    @param  blockData     Receives numBlock * 16 bytes
+    
+    @returns  Number of blocks read, -1 if the PN532 did not answer,
+              -2 if the exchange failed, -3 if the card reported an
+              error
+*/
+/**************************************************************************/
+int8_t DFRNFC::felica_ReadWithoutEncryption(uint8_t numService, const uint16_t * serviceCodes, uint8_t numBlock, const uint16_t * blockList, uint8_t * blockData)
+{
+  uint8_t len = 0;
+  uint8_t head[14];   // Status, LEN, response code, IDm, status flags 1/2, block count
+
+  if ((numService < 1) || (numService > 16) || (numBlock < 1) || (numBlock > FELICA_READ_MAXBLOCKS))
+    return -2;
+  if (13 + numService*2 + numBlock*2 > PN532_PACKBUFFSIZ)
+    return -2;
+
+  pn532_packetbuffer[len++] = PN532_COMMAND_INDATAEXCHANGE;
+  pn532_packetbuffer[len++] = 1;
+  pn532_packetbuffer[len++] = 0;              /* FeliCa LEN, filled in below */
+  pn532_packetbuffer[len++] = FELICA_CMD_READ_WITHOUT_ENCRYPTION;
+  memcpy (pn532_packetbuffer+len, _idm, 8);
+  len += 8;
+  pn532_packetbuffer[len++] = numService;
+  for (uint8_t i = 0; i < numService; i++)
+  {
+    pn532_packetbuffer[len++] = serviceCodes[i] & 0xFF;   /* little endian */
+    pn532_packetbuffer[len++] = serviceCodes[i] >> 8;
+  }
+  pn532_packetbuffer[len++] = numBlock;
+  for (uint8_t i = 0; i < numBlock; i++)
+  {
+    pn532_packetbuffer[len++] = 0x80 | (blockList[i] >> 8);  /* 2 byte element */
+    pn532_packetbuffer[len++] = blockList[i] & 0xFF;
+  }
+  pn532_packetbuffer[2] = len - 2;
+
+  if (!sendCommandCheckAck(pn532_packetbuffer, len))
+    return -1;
+
+  int16_t n = readframe(PN532_COMMAND_INDATAEXCHANGE, head, sizeof(head), blockData, numBlock*16);
+  if (n < 0)
+    return -1;
+  if (n < 13)
+  {
+    _lastError = PN532_ERROR_FRAME;
+    return -2;
+  }
+  if (!checkstatus(head[0]))
+    return -2;
+  if ((head[11] != 0x00) || (n < 14))
+    return -3;   // status flag 1 set, no block data follows
+  if ((head[13] > numBlock) || (n < 14 + head[13]*16))
+  {
+    _lastError = PN532_ERROR_FRAME;   // more blocks than asked for, or than sent
+    return -2;
+  }
+
+  return head[13];
+}
+
+
+/***** ISO14443B Functions ******/
+
+/**************************************************************************/
+/*! 
+    Waits for an ISO14443B card to enter the field and returns its ATQB
+    (PUPI, application data and protocol info).
+
+    @param  afi           Application family identifier, 0 for all
+    @param  atqb          Receives the 12 byte ATQB
+    
+    @returns 1 if a card was found, 0 otherwise
+*/
+/**************************************************************************/
+boolean DFRNFC::iso14443b_Poll(uint8_t afi, uint8_t * atqb)
+{
+  pn532_packetbuffer[0] = PN532_COMMAND_INLISTPASSIVETARGET;
+  pn532_packetbuffer[1] = 1;
+  pn532_packetbuffer[2] = PN532_ISO14443B;
+  pn532_packetbuffer[3] = afi;
+
+  if (!sendCommandCheckAck(pn532_packetbuffer, 4))
+    return 0;
+
+  /* byte    Description
+     ------  ------------------------------------------
+     b0      Tags Found
+     b1      Tag Number
+     b2..13  ATQB
+     b14     ATTRIB_RES length
+     b15..   ATTRIB_RES                                 */
+  int16_t n = readframe(PN532_COMMAND_INLISTPASSIVETARGET, pn532_packetbuffer, PN532_PACKBUFFSIZ);
+  if (n < 1)
+    return 0;
+  if (pn532_packetbuffer[0] != 1)
+  {
+    _lastError = PN532_ERROR_NOCARD;
+    return 0;
+  }
+  if (n < 14)
+  {
+    _lastError = PN532_ERROR_FRAME;
+    return 0;
+  }
+
+  memcpy (atqb, pn532_packetbuffer+2, 12);
+  return 1;
+}
+
+
+/***** Mifare Classic Functions ******/
+
+/**************************************************************************/
+/*! 
+      Indicates whether the specified block number is the first block
+      in the sector (block 0 relative to the current sector)
+*/
+/**************************************************************************/
+boolean DFRNFC::mifareclassic_IsFirstBlock (uint32_t uiBlock)
+{
+  // Test if we are in the small or big sectors
+  if (uiBlock < 128)
+    return ((uiBlock) % 4 == 0);
+  else
+    return ((uiBlock) % 16 == 0);
+}
+
+/**************************************************************************/
+/*! 
+      Indicates whether the specified block number is the sector trailer
+*/
+/**************************************************************************/
+boolean DFRNFC::mifareclassic_IsTrailerBlock (uint32_t uiBlock)
+{
+  // Test if we are in the small or big sectors
+  if (uiBlock < 128)
+    return ((uiBlock + 1) % 4 == 0);
+  else
+    return ((uiBlock + 1) % 16 == 0);
+}
+
+/**************************************************************************/
+/*! 
+    Tries to authenticate a block of memory on a MIFARE card using the
+    INDATAEXCHANGE command.  See section 7.3.8 of the PN532 User Manual
+    for more information on sending MIFARE and other commands.
+
+    @param  uid           Pointer to a byte array containing the card UID
+    @param  uidLen        The length (in bytes) of the card's UID (Should
+                          be 4 for MIFARE Classic)
+    @param  blockNumber   The block number to authenticate.  (0..63 for
+                          1KB cards, and 0..255 for 4KB cards).
+    @param  keyNumber     Which key type to use during authentication
+                          (0 = MIFARE_CMD_AUTH_A, 1 = MIFARE_CMD_AUTH_B)
+    @param  keyData       Pointer to a byte array containing the 6 byte
+                          key value
+    
+    @returns 1 if everything executed properly, 0 for an error
+*/
+/**************************************************************************/
+uint8_t DFRNFC::mifareclassic_AuthenticateBlock (uint8_t * uid, uint8_t uidLen, uint32_t blockNumber, uint8_t keyNumber, uint8_t * keyData)
+{
+  uint8_t len;
+  uint8_t i;
+  
+  _authSector = PN532_NOSECTOR;   // the old sector is left even if this fails
+
+  // Hang on to the key and uid data
+  memcpy (_key, keyData, 6); 
+  memcpy (_uid, uid, uidLen); 
+  uidLength = uidLen;  
+  
+  // Prepare the authentication command, InDataExchange comes from the template //
+  pn532_packetbuffer[0] = (keyNumber) ? MIFARE_CMD_AUTH_B : MIFARE_CMD_AUTH_A;
+  pn532_packetbuffer[1] = blockNumber;                    /* Block Number (1K = 0..63, 4K = 0..255 */
+  memcpy (pn532_packetbuffer+2, _key, 6);
+  for (i = 0; i < uidLength; i++)
+  {
+    pn532_packetbuffer[8+i] = _uid[i];                 /* 4 byte card ID */
+  }
+
+  if (! sendcheckack(frameDataExchange, pn532_packetbuffer, 8+uidLength, 0, 0))
+    return 0;
+
+  // Read the response packet
+  if (readframe(PN532_COMMAND_INDATAEXCHANGE, pn532_packetbuffer, PN532_PACKBUFFSIZ) < 1)
+    return 0;
+  // Mifare auth error is technically 0x14 but anything other and 0x00 is not good
+  if (!checkstatus(pn532_packetbuffer[0]))
+  {
+    return 0;
+  }
+
+  return 1;
+}
+
+/**************************************************************************/
+/*! 
+    Tries to read an entire 16-byte data block at the specified block
+    address.
+
+    @param  blockNumber   The block number to authenticate.  (0..63 for
+                          1KB cards, and 0..255 for 4KB cards).
+    @param  data          Pointer to the byte array that will hold the
+                          retrieved data (if any)
+    
+    @returns 1 if everything executed properly, 0 for an error
+*/
+/**************************************************************************/
+uint8_t DFRNFC::mifareclassic_ReadDataBlock (uint8_t blockNumber, uint8_t * data)
+{
+  /* Prepare the command */
+  pn532_packetbuffer[0] = MIFARE_CMD_READ;        /* Mifare Read command = 0x30 */
+  pn532_packetbuffer[1] = blockNumber;            /* Block Number (0..63 for 1K, 0..255 for 4K) */
+
+  /* Send the command */
+  if (! sendcheckack(frameDataExchange, pn532_packetbuffer, 2, 0, 0))
+  {
+    return 0;
+  }
+
+  /* Read the response packet */
+  int16_t n = readframe(PN532_COMMAND_INDATAEXCHANGE, pn532_packetbuffer, PN532_PACKBUFFSIZ);
+  if (n < 1)
+    return 0;
+
+  /* If the status byte isn't 0x00 we probably have an error */
+  if (!checkstatus(pn532_packetbuffer[0]) || (n != 17))
+  {
+    if (_lastError == PN532_ERROR_NONE)
+      _lastError = PN532_ERROR_FRAME;
+    return 0;
+  }
+    
+  /* Copy the 16 data bytes to the output buffer             */
+  /* Block content follows the status byte of a valid answer */
+  memcpy (data, pn532_packetbuffer+1, 16);
+
+  return 1;  
+}
+
+/**************************************************************************/
+/*! 
+    Tries to write an entire 16-byte data block at the specified block
+    address.
+
+    @param  blockNumber   The block number to authenticate.  (0..63 for
+                          1KB cards, and 0..255 for 4KB cards).
+    @param  data          The byte array that contains the data to write.
+    
+    @returns 1 if everything executed properly, 0 for an error
+*/
+/**************************************************************************/
+uint8_t DFRNFC::mifareclassic_WriteDataBlock (uint8_t blockNumber, uint8_t * data)
+{
+  /* Prepare the first command, the payload is sent straight from data */
+  pn532_packetbuffer[0] = MIFARE_CMD_WRITE;       /* Mifare Write command = 0xA0 */
+  pn532_packetbuffer[1] = blockNumber;            /* Block Number (0..63 for 1K, 0..255 for 4K) */
+
+  /* Send the command */
+  if (! sendcheckack(frameDataExchange, pn532_packetbuffer, 2, data, 16))
+  {
+    return 0;
+  }  
+    delay(2);
+  /* Read the response packet */
+  if (readframe(PN532_COMMAND_INDATAEXCHANGE, pn532_packetbuffer, PN532_PACKBUFFSIZ) < 1)
+    return 0;
+
+  return checkstatus(pn532_packetbuffer[0]);  
+}
+
+/**************************************************************************/
+/*! 
+    Formats a Mifare Classic card to store NDEF Records 
+    
+    @returns 1 if everything executed properly, 0 for an error
+*/
+/**************************************************************************/
+uint8_t DFRNFC::mifareclassic_FormatNDEF (void)
+{
+  uint8_t sectorbuffer[16];
+
+  // Write block 1 and 2 to the card
+  memcpy_P (sectorbuffer, ndefMad1, 16);
+  if (!(mifareclassic_WriteDataBlock (1, sectorbuffer)))
+    return 0;
+  memcpy_P (sectorbuffer, ndefMad2, 16);
+  if (!(mifareclassic_WriteDataBlock (2, sectorbuffer)))
+    return 0;
+  // Write key A and access rights card
+  memcpy_P (sectorbuffer, ndefMadTrailer, 16);
+  if (!(mifareclassic_WriteDataBlock (3, sectorbuffer)))
+    return 0;
+
+  // Seems that everything was OK (?!)
+  return 1;
+}
+
+/**************************************************************************/
+/*! 
+    Writes an NDEF URI Record to the specified sector (1..15)
+    
+    Note that this function assumes that the Mifare Classic card is
+    already formatted to work as an "NFC Forum Tag" and uses a MAD1
+    file system.  You can use the NXP TagWriter app on Android to
+    properly format cards for this.
+
+    @param  sectorNumber  The sector that the URI record should be written
+                          to (can be 1..15 for a 1K card)
+    @param  uriIdentifier The uri identifier code (0 = none, 0x01 = 
+                          "http://www.", etc.)
+    @param  url           The uri text to write (max 38 characters).
+    
+    @returns 1 if everything executed properly, 0 for an error
+*/
+/**************************************************************************/
+uint8_t DFRNFC::mifareclassic_WriteNDEFURI (uint8_t sectorNumber, uint8_t uriIdentifier, const char * url)
+{
+  // Figure out how long the string is
+  uint8_t len = strlen(url);
+  
+  // Make sure we're within a 1K limit for the sector number
+  if ((sectorNumber < 1) || (sectorNumber > 15))
+    return 0;
+  
+  // Make sure the URI payload is between 1 and 38 chars
+  if ((len < 1) || (len > 38))
+    return 0;
+    
+  // Setup the sector buffer (w/pre-formatted TLV wrapper and NDEF message)
+  uint8_t sectorbuffer1[16] = {0x00, 0x00, 0x03, (uint8_t)(len+5), 0xD1, 0x01, (uint8_t)(len+1), 0x55, uriIdentifier, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+  uint8_t sectorbuffer2[16] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+  uint8_t sectorbuffer3[16] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
   if (len <= 6)
   {
-    // Unlikely we'll get a url this short, but why not ...
-    memcpy (sectorbuffer1+9, url, len);
-    sectorbuffer1[len+9] = 0xFE;
+    // Unlikely we'll get a url this short, but why not ...
+    memcpy (sectorbuffer1+9, url, len);
+    sectorbuffer1[len+9] = 0xFE;
+  }
+  else if (len == 7)
+  {
+    // 0xFE needs to be wrapped around to next block
+    memcpy (sectorbuffer1+9, url, len);
+    sectorbuffer2[0] = 0xFE;
+  }
+  else if (len <= 22)
+  {
+    // Url fits in two blocks
+    memcpy (sectorbuffer1+9, url, 7);
+    memcpy (sectorbuffer2, url+7, len-7);
+    sectorbuffer2[len-7] = 0xFE;
+  }
+  else if (len == 23)
+  {
+    // 0xFE needs to be wrapped around to final block
+    memcpy (sectorbuffer1+9, url, 7);
+    memcpy (sectorbuffer2, url+7, len-7);
+    sectorbuffer3[0] = 0xFE;
+  }
+  else
+  {
+    // Url fits in three blocks
+    memcpy (sectorbuffer1+9, url, 7);
+    memcpy (sectorbuffer2, url+7, 16);
+    memcpy (sectorbuffer3, url+23, len-23);
+    sectorbuffer3[len-23] = 0xFE;
+  }
+  
+  // Now write all three blocks back to the card
+  if (!(mifareclassic_WriteDataBlock (sectorNumber*4, sectorbuffer1)))
+    return 0;
+  if (!(mifareclassic_WriteDataBlock ((sectorNumber*4)+1, sectorbuffer2)))
+    return 0;
+  if (!(mifareclassic_WriteDataBlock ((sectorNumber*4)+2, sectorbuffer3)))
+    return 0;
+  // The trailer goes through the first buffer, it is written already
+  memcpy_P (sectorbuffer1, ndefSectorTrailer, 16);
+  if (!(mifareclassic_WriteDataBlock ((sectorNumber*4)+3, sectorbuffer1)))
+    return 0;
+
+  // Seems that everything was OK (?!)
+  return 1;
+}
+
+/**************************************************************************/
+/*! 
+    Writes an NDEF URI Record to the specified sector (1..15), picking
+    the uri identifier code that abbreviates the longest prefix of url.
+    The same formatting requirements as above apply, but up to 38
+    characters are left after the prefix is removed.
+
+    @param  sectorNumber  The sector that the URI record should be written
+                          to (can be 1..15 for a 1K card)
+    @param  url           The complete uri, e.g. "https://www.dfrobot.com"
+    
+    @returns 1 if everything executed properly, 0 for an error
+*/
+/**************************************************************************/
+uint8_t DFRNFC::mifareclassic_WriteNDEFURI (uint8_t sectorNumber, const char * url)
+{
+  uint8_t prefixLength;
+  uint8_t uriIdentifier = NDEFMessage::encodeUriPrefix(url, &prefixLength);
+  return mifareclassic_WriteNDEFURI(sectorNumber, uriIdentifier, url+prefixLength);
+}
+
+/**************************************************************************/
+/*! 
+    Reads the NDEF message of an NFC Forum formatted Mifare Classic card,
+    starting at sector 1. Blocks are handed to the parser as they are
+    read and reading stops as soon as the parser has the whole message,
+    so a short record costs one authentication and a couple of block
+    reads. Sector trailers are skipped and each sector is authenticated
+    once with the public NDEF key A.
+
+    @param  uid           Pointer to a byte array containing the card UID
+    @param  uidLen        The length (in bytes) of the card's UID
+    @param  parser        The parser collecting the message
+    
+    @returns 1 if a complete message was read, 0 for an error
+*/
+/**************************************************************************/
+uint8_t DFRNFC::mifareclassic_ReadNDEF (uint8_t * uid, uint8_t uidLen, NDEFParser * parser)
+{
+  parser->reset();
+
+  // 1K cards have 16 sectors of 4 blocks, 4K cards add 8 sectors of 16 blocks
+  for (uint8_t sector = 1; sector < 40; sector++)
+  {
+    if (sector == 16)
+      continue;   // MAD2 of 4K cards
+
+    uint8_t firstBlock = (sector < 32) ? sector*4 : 128 + (sector-32)*16;
+    uint8_t blockCount = (sector < 32) ? 4 : 16;
+
+    if (!authenticate_P (uid, uidLen, firstBlock, 0, keyndef))
+      return 0;
+
+    for (uint8_t i = 0; i < blockCount-1; i++)
+    {
+      if (!mifareclassic_ReadDataBlock (firstBlock+i, data))
+        return 0;
+      int8_t result = parser->feed(data, 16);
+      if (result == NDEF_PARSE_DONE)
+        return 1;
+      if (result < 0)
+        return 0;
+    }
+  }
+
+  return 0;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  CRC-8 of a Mifare Application Directory (polynomial 0x1D,
+            preset 0xC7), computed over the info byte and the AIDs
+*/
+/**************************************************************************/
+static uint8_t mad_crc(const uint8_t *data, uint8_t len)
+{
+  uint8_t crc = 0xC7;
+  for (uint8_t i = 0; i < len; i++)
+  {
+    crc ^= data[i];
+    for (uint8_t bit = 0; bit < 8; bit++)
+      crc = (crc & 0x80) ? (crc << 1) ^ 0x1D : (crc << 1);
+  }
+  return crc;
+}
+
+/**************************************************************************/
+/*! 
+    Writes an NDEF message of any length to a Mifare Classic card,
+    formatting it for NDEF on the way.
+
+    The message is laid out over as many sectors as it needs, starting
+    at sector 1. Sector 0 gets a MAD1 marking those sectors as NDEF
+    (AID 0x03E1); messages that do not fit the 15 sectors of a 1K card
+    continue past the MAD2 in sector 16 of a 4K card. Every sector is
+    authenticated once with key B (0xFF..), only the blocks the message
+    touches are written, followed by the NDEF sector trailer.
+
+    @param  uid           Pointer to a byte array containing the card UID
+    @param  uidLen        The length (in bytes) of the card's UID
+    @param  message       The message to write
+    
+    @returns 1 if everything executed properly, 0 for an error
+*/
+/**************************************************************************/
+uint8_t DFRNFC::mifareclassic_WriteNDEF (uint8_t * uid, uint8_t uidLen, NDEFMessage * message)
+{
+  uint8_t madTrailer[16];
+  uint8_t ndefTrailer[16];
+  uint8_t mad[48];
+  uint16_t tlvLen = message->tlvLength();
+  uint16_t offset;
+  uint8_t sector, sectorCount;
+
+  memcpy_P (madTrailer, ndefMadTrailer, 16);
+  memcpy_P (ndefTrailer, ndefSectorTrailer, 16);
+
+  // Count the sectors the message needs, sector 16 is taken by MAD2
+  offset = 0;
+  sectorCount = 0;
+  for (sector = 1; offset < tlvLen; sector++)
+  {
+    if (sector == 16)
+      continue;
+    if (sector >= 40)
+      return 0;
+    offset += (sector < 32) ? 48 : 240;
+    sectorCount = sector;
+  }
+
+  // MAD1: info byte, then one AID per sector 1..15
+  memset (mad, 0, sizeof(mad));
+  mad[1] = 0x01;
+  for (sector = 1; sector <= 15 && sector <= sectorCount; sector++)
+  {
+    mad[sector*2] = 0x03;
+    mad[sector*2+1] = 0xE1;
+  }
+  mad[0] = mad_crc(mad+1, 31);
+  if (sectorCount > 15)
+  {
+    madTrailer[9] = 0xC2;   // GPB announces MAD2
+    // Make sure the card has sector 16 before the MAD points at it
+    if (!authenticate_P (uid, uidLen, 64, 1, keyuniversal))
+      return 0;
+  }
+
+  if (!authenticate_P (uid, uidLen, 0, 1, keyuniversal))
+    return 0;
+  if (!mifareclassic_WriteDataBlock (1, mad))
+    return 0;
+  if (!mifareclassic_WriteDataBlock (2, mad+16))
+    return 0;
+  if (!mifareclassic_WriteDataBlock (3, madTrailer))
+    return 0;
+
+  if (sectorCount > 15)
+  {
+    // MAD2: info byte, then one AID per sector 17..39
+    memset (mad, 0, sizeof(mad));
+    mad[1] = 0x01;
+    for (sector = 17; sector <= sectorCount; sector++)
+    {
+      mad[(sector-16)*2] = 0x03;
+      mad[(sector-16)*2+1] = 0xE1;
+    }
+    mad[0] = mad_crc(mad+1, 47);
+
+    if (!authenticate_P (uid, uidLen, 64, 1, keyuniversal))
+      return 0;
+    for (uint8_t i = 0; i < 3; i++)
+    {
+      if (!mifareclassic_WriteDataBlock (64+i, mad+i*16))
+        return 0;
+    }
+    if (!mifareclassic_WriteDataBlock (67, madTrailer))
+      return 0;
+  }
+
+  // Stream the TLV into the data blocks, one authentication per sector
+  offset = 0;
+  for (sector = 1; sector <= sectorCount; sector++)
+  {
+    if (sector == 16)
+      continue;
+
+    uint8_t firstBlock = (sector < 32) ? sector*4 : 128 + (sector-32)*16;
+    uint8_t blockCount = (sector < 32) ? 4 : 16;
+
+    if (!authenticate_P (uid, uidLen, firstBlock, 1, keyuniversal))
+      return 0;
+
+    for (uint8_t i = 0; i < blockCount-1 && offset < tlvLen; i++)
+    {
+      for (uint8_t j = 0; j < 16; j++)
+        data[j] = message->tlvByte(offset++);
+      if (!mifareclassic_WriteDataBlock (firstBlock+i, data))
+        return 0;
+    }
+    if (!mifareclassic_WriteDataBlock (firstBlock+blockCount-1, ndefTrailer))
+      return 0;
+  }
+
+  return 1;
+}
+
+/***** Mifare Ultralight Functions ******/
+
+/**************************************************************************/
+/*! 
+    Tries to read an entire 4-byte page at the specified address.
+
+    @param  page        The page number (0..63 in most cases)
+    @param  buffer      Pointer to the byte array that will hold the
+                        retrieved data (if any)
+*/
+/**************************************************************************/
+uint8_t DFRNFC::mifareultralight_ReadPage (uint8_t page, uint8_t * buffer)
+{
+  if (page >= 64)
+  {
+    _lastError = PN532_ERROR_RANGE;
+    return 0;
+  }
+
+  /* Prepare the command */
+  pn532_packetbuffer[0] = MIFARE_CMD_READ;     /* Mifare Read command = 0x30 */
+  pn532_packetbuffer[1] = page;                /* Page Number (0..63 in most cases) */
+
+  /* Send the command */
+  if (! sendcheckack(frameDataExchange, pn532_packetbuffer, 2, 0, 0))
+  {
+    return 0;
+  }
+  
+  /* Read the response packet */
+  int16_t n = readframe(PN532_COMMAND_INDATAEXCHANGE, pn532_packetbuffer, PN532_PACKBUFFSIZ);
+  if (n < 1)
+    return 0;
+
+  /* If the status byte isn't 0x00 we probably have an error */
+  if (checkstatus(pn532_packetbuffer[0]) && (n == 17))
+  {
+    /* Copy the 4 data bytes to the output buffer         */
+    /* Block content follows the status byte              */
+    /* Note that the command actually reads 16 byte or 4  */
+    /* pages at a time ... we simply discard the last 12  */
+    /* bytes                                              */
+    memcpy (buffer, pn532_packetbuffer+1, 4);
+  }
+  else
+  {
+    if (_lastError == PN532_ERROR_NONE)
+      _lastError = PN532_ERROR_FRAME;
+    return 0;
+  }
+
+  // Return OK signal
+  return 1;
+}
+
+/**************************************************************************/
+/*! 
+    Reads four consecutive pages (16 bytes) starting at the specified
+    page, which is what a single READ command returns anyway. The
+    address wraps around at the end of the tag's memory.
+
+    @param  page        The first page number (0..0xE6 for NTAG216)
+    @param  buffer      Pointer to a 16 byte array that will hold the
+                        retrieved data (if any)
+    
+    @returns 1 if everything executed properly, 0 for an error
+*/
+/**************************************************************************/
+uint8_t DFRNFC::mifareultralight_ReadPages (uint8_t page, uint8_t * buffer)
+{
+  /* Prepare the command */
+  pn532_packetbuffer[0] = MIFARE_CMD_READ;     /* Mifare Read command = 0x30 */
+  pn532_packetbuffer[1] = page;                /* First page number */
+
+  /* Send the command */
+  if (! sendcheckack(frameDataExchange, pn532_packetbuffer, 2, 0, 0))
+  {
+    return 0;
+  }
+  
+  /* Read the response packet */
+  int16_t n = readframe(PN532_COMMAND_INDATAEXCHANGE, pn532_packetbuffer, PN532_PACKBUFFSIZ);
+  if (n < 1)
+    return 0;
+
+  /* If the status byte isn't 0x00 we probably have an error */
+  if (!checkstatus(pn532_packetbuffer[0]) || (n != 17))
+  {
+    if (_lastError == PN532_ERROR_NONE)
+      _lastError = PN532_ERROR_FRAME;
+    return 0;
+  }
+
+  memcpy (buffer, pn532_packetbuffer+1, 16);
+  return 1;
+}
+
+/**************************************************************************/
+/*! 
+    Writes an entire 4-byte page at the specified address.
+
+    @param  page        The page number
+    @param  data        The 4 bytes to write
+    
+    @returns 1 if everything executed properly, 0 for an error
+*/
+/**************************************************************************/
+uint8_t DFRNFC::mifareultralight_WritePage (uint8_t page, uint8_t * data)
+{
+  if (page == 3)
+    _capacityGeneration = _generation - 1;   // the CC changes, read the capacity again
+
+  /* Prepare the command */
+  pn532_packetbuffer[0] = MIFARE_CMD_WRITE_ULTRALIGHT;  /* Ultralight Write command = 0xA2 */
+  pn532_packetbuffer[1] = page;                         /* Page Number */
+
+  /* Send the command, the payload is sent straight from data */
+  if (! sendcheckack(frameDataExchange, pn532_packetbuffer, 2, data, 4))
+  {
+    return 0;
+  }
+
+  /* Read the response packet */
+  if (readframe(PN532_COMMAND_INDATAEXCHANGE, pn532_packetbuffer, PN532_PACKBUFFSIZ) < 1)
+    return 0;
+
+  return checkstatus(pn532_packetbuffer[0]);
+}
+
+/***** NTAG2xx / Type 2 Tag Functions ******/
+
+/**************************************************************************/
+/*! 
+    Reads the NDEF message of an NFC Forum Type 2 Tag (NTAG21x,
+    Ultralight). The capability container on page 3 gives the size of
+    the data area starting at page 4. The first READ returns the CC
+    together with the first 12 bytes of data, the TLVs are then streamed
+    16 bytes per READ until the parser has the whole message.
+
+    @param  parser        The parser collecting the message
+    
+    @returns 1 if a complete message was read, 0 for an error
+*/
+/**************************************************************************/
+uint8_t DFRNFC::ntag2xx_ReadNDEF (NDEFParser * parser)
+{
+  parser->reset();
+
+  if (!mifareultralight_ReadPages (3, data))
+    return 0;
+
+  // CC: magic number, version, data area size / 8, access conditions
+  if (data[0] != 0xE1)
+    return 0;
+  uint16_t areaSize = data[2] * 8;
+  uint16_t offset = (areaSize < 12) ? areaSize : 12;
+
+  int8_t result = parser->feed(data+4, offset);
+  while (result == NDEF_PARSE_MORE && offset < areaSize)
+  {
+    if (!mifareultralight_ReadPages (4 + offset/4, data))
+      return 0;
+    uint8_t len = (areaSize - offset < 16) ? areaSize - offset : 16;
+    result = parser->feed(data, len);
+    offset += len;
+  }
+
+  return (result == NDEF_PARSE_DONE);
+}
+
+/**************************************************************************/
+/*! 
+    Reads a range of pages of an NTAG21x with a single FAST_READ, sent
+    through InCommunicateThru. Up to 63 pages fit one exchange.
+
+    @param  startPage   The first page
+    @param  endPage     The last page (inclusive)
+    @param  buffer      Receives (endPage - startPage + 1) * 4 bytes
+    
+    @returns  Number of bytes read, < 0 as for inCommunicateThru
+*/
+/**************************************************************************/
+int16_t DFRNFC::ntag2xx_FastRead (uint8_t startPage, uint8_t endPage, uint8_t * buffer)
+{
+  uint8_t cmd[3] = {NTAG_CMD_FAST_READ, startPage, endPage};
+
+  if ((endPage < startPage) || (endPage - startPage >= 63))
+    return -3;
+
+  return inCommunicateThru(cmd, 3, buffer, (endPage - startPage + 1) * 4);
+}
+
+/**************************************************************************/
+/*! 
+    Reads the NFC counter of an NTAG21x (READ_CNT), which counts the
+    reader sessions when enabled in the configuration pages.
+
+    @param  counter     Receives the 24-bit counter
+    
+    @returns 1 if everything executed properly, 0 for an error
+*/
+/**************************************************************************/
+boolean DFRNFC::ntag2xx_ReadCounter (uint32_t * counter)
+{
+  uint8_t cmd[2] = {NTAG_CMD_READ_CNT, 0x02};
+  uint8_t value[3];
+
+  if (inCommunicateThru(cmd, 2, value, 3) != 3)
+    return 0;
+
+  *counter = ((uint32_t)value[2] << 16) | ((uint16_t)value[1] << 8) | value[0];  /* LSB first */
+  return 1;
+}
+
+/**************************************************************************/
+/*! 
+    Authenticates to a password protected NTAG21x (PWD_AUTH).
+
+    @param  password    The 4 byte password
+    @param  pack        Receives the 2 byte password acknowledge, compare
+                        it with the expected PACK to verify the tag
+    
+    @returns 1 if the tag accepted the password, 0 otherwise
+*/
+/**************************************************************************/
+boolean DFRNFC::ntag2xx_PasswordAuth (const uint8_t * password, uint8_t * pack)
+{
+  uint8_t cmd[5] = {NTAG_CMD_PWD_AUTH};
+  memcpy (cmd+1, password, 4);
+
+  return (inCommunicateThru(cmd, 5, pack, 2) == 2);
+}
+
+/**************************************************************************/
+/*! 
+    Writes an NDEF message to an NFC Forum Type 2 Tag. The capability
+    container is checked for the data area size and write access, then
+    only the pages covered by the message TLV and its terminator are
+    written, starting at page 4.
+
+    @param  message       The message to write
+    
+    @returns 1 if everything executed properly, 0 for an error
+*/
+/**************************************************************************/
+uint8_t DFRNFC::ntag2xx_WriteNDEF (NDEFMessage * message)
+{
+  uint8_t cc[4];
+  uint8_t page[4];
+
+  if (!mifareultralight_ReadPage (3, cc))
+    return 0;
+  if ((cc[0] != 0xE1) || ((cc[3] & 0x0F) != 0x00))
+    return 0;   // not formatted for NDEF or write protected
+
+  uint16_t tlvLen = message->tlvLength();
+  if (tlvLen > cc[2] * 8)
+    return 0;
+
+  for (uint16_t offset = 0; offset < tlvLen; offset += 4)
+  {
+    for (uint8_t i = 0; i < 4; i++)
+      page[i] = message->tlvByte(offset+i);
+    if (!mifareultralight_WritePage (4 + offset/4, page))
+      return 0;
+  }
+
+  return 1;
+}
+
+
+
+
+
+/**************************************************************************/
+/*! 
+    @brief  Tries to read the  ACK signal
+*/
+/**************************************************************************/
+boolean DFRNFC::readack() {
+  uint8_t ackbuff[6];
+
+  if (_serial->readBytes(ackbuff, 6) != 6)
+  {
+    _lastError = PN532_ERROR_TIMEOUT;
+    PN532_COUNT(timeouts);
+    PN532_TRACE(PN532_TRACE_ERROR);
+    return 0;
+  }
+  if (0 == memcmp_P(ackbuff, pn532ack, 6))
+  {
+    PN532_TRACE(PN532_TRACE_ACK);
+    return 1;
+  }
+
+  _lastError = (0 == memcmp_P(ackbuff, pn532nack, 6)) ? PN532_ERROR_NACK : PN532_ERROR_FRAME;
+  PN532_COUNT(frameErrors);
+  PN532_TRACE(PN532_TRACE_ERROR, ackbuff, 6);
+  return 0;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Checks the status byte of a response
+
+    @param  status    The status byte (error code in bits 0..5)
+    
+    @returns  1 for success, 0 if the PN532 or the card reported an
+              error, see lastError and lastStatus
+*/
+/**************************************************************************/
+boolean DFRNFC::checkstatus(uint8_t status)
+{
+  _lastStatus = status & 0x3F;
+  if (_lastStatus == 0x00)
+    return 1;
+
+  if (_lastStatus == 0x14)
+  {
+    _lastError = PN532_ERROR_AUTH;    // Mifare authentication error
+    PN532_COUNT(authFailures);
+  }
+  else
+  {
+    _lastError = PN532_ERROR_STATUS;
+    PN532_COUNT(statusErrors);
+  }
+  PN532_TRACE(PN532_TRACE_ERROR, &status, 1);
+  return 0;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Waits for the first byte of a response
+
+    @param  timeout   max time in ms to wait, 0 means no timeout
+    
+    @returns  1 once data is available, 0 on timeout
+*/
+/**************************************************************************/
+boolean DFRNFC::waitavailable(uint16_t timeout)
+{
+    unsigned long start = millis();
+    while (!_serial->available())
+    {
+        if (timeout && (millis() - start >= timeout))
+            return 0;
+    }
+    return 1;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Reads a response frame of variable length. The data following
+            the response code is split between two buffers so bulk data
+            can land in the caller's buffer without a staging copy.
+
+    @param  command   The command the response belongs to
+    @param  head      Receives the first headlen data bytes
+    @param  headlen   Size of head
+    @param  body      Receives the remaining data bytes
+    @param  bodylen   Size of body
+    
+    @returns  Number of data bytes in the frame, -1 for a timeout or a
+              malformed frame, -2 if the data did not fit the buffers
+*/
+/**************************************************************************/
+int16_t DFRNFC::readframe(uint8_t command, uint8_t *head, uint8_t headlen, uint8_t *body, uint16_t bodylen)
+{
+    uint8_t header[7];    // 00 00 FF LEN LCS TFI CODE
+    uint8_t checksum;
+    uint8_t len;
+    uint8_t n;
+
+    if (_serial->readBytes(header, 7) != 7)
+        return frameerror(PN532_ERROR_TIMEOUT);
+#ifdef PN532STATS
+    uint32_t frameStart = micros();
+#endif
+    if ((header[0] != PN532_PREAMBLE) || (header[1] != PN532_STARTCODE1) || (header[2] != PN532_STARTCODE2))
+        return frameerror(PN532_ERROR_FRAME);
+    if ((uint8_t)(header[3] + header[4]) != 0)
+        return frameerror(PN532_ERROR_CHECKSUM);
+    if ((header[3] < 2) || (header[5] != PN532_PN532TOHOST) || (header[6] != command+1))
+        return frameerror(PN532_ERROR_FRAME);   // also the PN532 error frame
+
+    checksum = header[5] + header[6];
+    len = header[3] - 2;
+
+    n = (len < headlen) ? len : headlen;
+    if (_serial->readBytes(head, n) != n)
+        return frameerror(PN532_ERROR_TIMEOUT);
+    for (uint8_t i = 0; i < n; i++)
+        checksum += head[i];
+
+    uint8_t rest = len - n;
+    n = (rest < bodylen) ? rest : bodylen;
+    if (_serial->readBytes(body, n) != n)
+        return frameerror(PN532_ERROR_TIMEOUT);
+    for (uint8_t i = 0; i < n; i++)
+        checksum += body[i];
+
+    // drop what does not fit, it still counts for the checksum
+    for (rest -= n; rest > 0; rest--)
+    {
+        uint8_t b;
+        if (_serial->readBytes(&b, 1) != 1)
+            return frameerror(PN532_ERROR_TIMEOUT);
+        checksum += b;
+    }
+
+    uint8_t trailer[2];   // DCS POSTAMBLE
+    if (_serial->readBytes(trailer, 2) != 2)
+        return frameerror(PN532_ERROR_TIMEOUT);
+    if ((uint8_t)(checksum + trailer[0]) != 0)
+        return frameerror(PN532_ERROR_CHECKSUM);
+    PN532_TRACE(PN532_TRACE_RX, head, (len < headlen) ? len : headlen,
+                body, (len < headlen) ? 0 : ((len - headlen < bodylen) ? len - headlen : bodylen));
+
+    // latency of the whole command, from sending it to its response,
+    // the average follows it with a weight of 1/8
+    uint32_t latency = micros() - _commandStart;
+    if (_latencyAverage == 0)
+        _latencyAverage = latency;
+    else
+        _latencyAverage = _latencyAverage - (_latencyAverage >> 3) + (latency >> 3);
+#ifdef PN532STATS
+    uint8_t bucket = 0;
+    for (uint32_t ms = latency / 1000; ms > 0 && bucket < PN532_LATENCY_BUCKETS-1; ms >>= 1)
+        bucket++;
+    _stats.latency[bucket]++;
+    if (latency > _stats.maxLatencyMicros)
+        _stats.maxLatencyMicros = latency;
+    _stats.lastLatencyMicros = latency;
+
+    // the decode cost, averaged with a weight of 1/8 like the latency
+    uint32_t decode = micros() - frameStart;
+    if (_stats.frames++ == 0)
+        _stats.frameMicros = decode;
+    else
+        _stats.frameMicros = _stats.frameMicros - (_stats.frameMicros >> 3) + (decode >> 3);
+    if (decode > _stats.maxFrameMicros)
+        _stats.maxFrameMicros = decode;
+#endif
+
+    if (len > (uint16_t)headlen + bodylen)
+    {
+        _lastError = PN532_ERROR_OVERFLOW;
+        PN532_TRACE(PN532_TRACE_ERROR);
+        return -2;
+    }
+    return len;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Records a frame level error for readframe
+
+    @returns  -1, the readframe result for broken frames
+*/
+/**************************************************************************/
+int16_t DFRNFC::frameerror(uint8_t error)
+{
+    _lastError = error;
+    PN532_TRACE(PN532_TRACE_ERROR);
+#ifdef PN532STATS
+    if (error == PN532_ERROR_TIMEOUT)
+        _stats.timeouts++;
+    else
+        _stats.frameErrors++;
+#endif
+    return -1;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Writes a command to the PN532, automatically inserting the
+            preamble and required frame details (checksum, len, etc.).
+            The frame is assembled in _frame and goes out with a single
+            write, frames longer than PN532_FRAMEBUFFSIZ in pieces.
+            With a template the header and its part of the checksum
+            come precomputed from PROGMEM, only LEN and LCS are patched
+            and cmd and body are added to the checksum
+
+    @param  tmpl      Frame template in PROGMEM, or 0. Templated frames
+                      must fit into _frame
+    @param  cmd       Pointer to the command buffer
+    @param  cmdlen    Command length in bytes 
+    @param  body      Optional data appended to the command
+    @param  bodylen   Data length in bytes
+*/
+/**************************************************************************/
+void DFRNFC::writecommand(const uint8_t *tmpl, uint8_t* cmd, uint8_t cmdlen, const uint8_t *body, uint8_t bodylen)
+{
+    uint8_t len = cmdlen + bodylen;
+    uint8_t checksum;
+    uint8_t n;
+
+    if (tmpl)
+    {
+        n = pgm_read_byte(tmpl);
+        checksum = pgm_read_byte(tmpl + 1);
+        memcpy_P(_frame, tmpl + 2, n);
+        _frame[3] += len;
+        _frame[4] = ~_frame[3] + 1;
+    }
+    else
+    {
+        n = 6;
+        checksum = PN532_HOSTTOPN532;
+        _frame[0] = PN532_PREAMBLE;
+        _frame[1] = PN532_STARTCODE1;
+        _frame[2] = PN532_STARTCODE2;
+        _frame[3] = len + 1;
+        _frame[4] = ~(len + 1) + 1;
+        _frame[5] = PN532_HOSTTOPN532;
+    }
+
+    for (uint8_t i=0; i<len; i++) 
+    {
+        uint8_t b = (i < cmdlen) ? cmd[i] : body[i-cmdlen];
+        if (n == sizeof(_frame))
+        {
+            _serial->write(_frame, n);   // frame longer than the buffer
+            n = 0;
+        }
+        _frame[n++] = b;
+        checksum += b;
+    }
+    if (n > sizeof(_frame) - 2)
+    {
+        _serial->write(_frame, n);
+        n = 0;
+    }
+    _frame[n++] = ~checksum + 1;
+    _frame[n++] = PN532_POSTAMBLE;
+    _serial->write(_frame, n);
+
+#ifdef PN532TRACE
+    if (tmpl)
+    {
+        _traceCommand = _frame[6];
+        trace(PN532_TRACE_TX, _frame + 6, _frame[3] - 1);
+    }
+    else
+    {
+        _traceCommand = cmdlen ? cmd[0] : body[0];
+        trace(PN532_TRACE_TX, cmd, cmdlen, body, bodylen);
+    }
+#endif
+}
+
+// Copies between a caller buffer and the data area for read/write/readBytes/writeBytes
+struct bytecopy
+{
+    uint8_t *buff;
+    unsigned int start;   // data address of buff[0]
+};
+
+static boolean copyout(unsigned int byteAddr, uint8_t *data, uint8_t len, void *context)
+{
+    bytecopy *copy = (bytecopy *)context;
+    memcpy(copy->buff + (byteAddr - copy->start), data, len);
+    return 1;
+}
+
+static boolean copyin(unsigned int byteAddr, uint8_t *data, uint8_t len, void *context)
+{
+    bytecopy *copy = (bytecopy *)context;
+    memcpy(data, copy->buff + (byteAddr - copy->start), len);
+    return 1;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  read a byte of the data area, the address should be with the
+            rage of dataCapacity: 0 - 751 on a Mifare Classic 1K, from
+            Bytes 0 of block 1 to Byte 16 of block 62 
+
+    @param  byteAddr    the address of the data to read
+    
+    @returns   -1   if address is without the range, see dataCapacity
+               -2   if failed to find a card
+               -3   if authentication failed
+               -4   if failed to read block
+               data if succeed
+*/
+/**************************************************************************/
+int DFRNFC::read(unsigned int byteAddr)
+{   
+    uint8_t byteData;
+    bytecopy copy = {&byteData, byteAddr};
+    int result = streamdata(byteAddr, 1, copyout, &copy, 0);
+    if(result < 0)
+        return result;
+    return byteData; //return data
+}
+
+
+/**************************************************************************/
+/*! 
+    @brief  read string from data area, the end address should be with
+            the rage of dataCapacity
+
+    @param  buff            receives the data
+    @param  byteAddrStart   the address of the first byte
+    @param  length          number of bytes
+    
+    @returns   -1   if address is without the range, see dataCapacity
+               -2   if failed to find a card
+               -3   if authentication failed
+               -4   if failed to read block
+               1    if succeed
+*/
+/**************************************************************************/
+int DFRNFC::readBytes(uint8_t* buff, unsigned int byteAddrStart, unsigned int length)
+{  
+    bytecopy copy = {buff, byteAddrStart};
+    return streamdata(byteAddrStart, length, copyout, &copy, 0);
+}
+
+
+/**************************************************************************/
+/*! 
+    @brief  read data bytes like readBytes, without a buffer for the whole
+            range: every block is passed to the callback on its own, so
+            16 bytes of RAM are enough for any length
+
+    @param  byteAddrStart   the address of the first byte
+    @param  length          number of bytes
+    @param  callback        receives the bytes of one block at a time
+    @param  context         passed to the callback
+    
+    @returns   -1   if address is without the range, see dataCapacity
+               -2   if failed to find a card
+               -3   if authentication failed
+               -4   if failed to read block
+               0    if the callback stopped the stream
+               1    if succeed
+*/
+/**************************************************************************/
+int DFRNFC::readStream(unsigned int byteAddrStart, unsigned int length, PN532ChunkCallback callback, void *context)
+{
+    return streamdata(byteAddrStart, length, callback, context, 0);
+}
+
+
+/**************************************************************************/
+/*! 
+    @brief  write a byte of the data area, the address should be with the
+            rage of dataCapacity
+
+    @param  byteAddr    the address of the data to write
+    @param  byteData    the new value
+    
+    @returns   -1   if address is without the range, see dataCapacity
+               -2   if failed to find a card
+               -3   if authentication failed
+               -4   if failed to read the block
+               -5   if failed to write the block
+               1    if succeed
+*/
+/**************************************************************************/
+int DFRNFC::write(unsigned int byteAddr,uint8_t byteData)
+{
+    bytecopy copy = {&byteData, byteAddr};
+    return streamdata(byteAddr, 1, copyin, &copy, 1);
+}
+
+
+/**************************************************************************/
+/*! 
+    @brief  write string to data area, the end address should be with the
+            rage of dataCapacity
+
+    @param  buff            the data
+    @param  byteAddrStart   the address of the first byte
+    @param  length          number of bytes
+    
+    @returns   -1   if address is without the range, see dataCapacity
+               -2   if failed to find a card
+               -3   if authentication failed
+               -4   if failed to read block
+               -5   if failed to write the block
+               1    if succeed
+*/
+/**************************************************************************/
+int DFRNFC::writeBytes(uint8_t* buff, unsigned int byteAddrStart, unsigned int length)
+{  
+    bytecopy copy = {buff, byteAddrStart};
+    return streamdata(byteAddrStart, length, copyin, &copy, 1);
+}
+
+
+/**************************************************************************/
+/*! 
+    @brief  write data bytes like writeBytes, the callback fills one
+            block at a time, so 16 bytes of RAM are enough for any
+            length
+
+    @param  byteAddrStart   the address of the first byte
+    @param  length          number of bytes
+    @param  callback        fills data with the len bytes for byteAddr
+    @param  context         passed to the callback
+    
+    @returns   -1   if address is without the range, see dataCapacity
+               -2   if failed to find a card
+               -3   if authentication failed
+               -4   if failed to read block
+               -5   if failed to write the block
+               0    if the callback stopped the stream
+               1    if succeed
+*/
+/**************************************************************************/
+int DFRNFC::writeStream(unsigned int byteAddrStart, unsigned int length, PN532ChunkCallback callback, void *context)
+{
+    return streamdata(byteAddrStart, length, callback, context, 1);
+}
+
+
+/**************************************************************************/
+/*! 
+    @brief  Size of the data area the byte address functions reach on
+            the card in the field:
+            Mifare Classic 1K   752 bytes, data blocks 1 - 62
+            Mifare Classic 4K   3440 bytes, adds sectors 16 - 39
+            Type 2 Tag          the data area of the capability
+                                container from page 4 on, e.g. 872
+                                bytes on an NTAG216
+            Addresses beyond the largest area (a 4K card) are out of
+            range for every card, the byte address functions reject them
+            with -1 first. The card in the field is only known after it
+            answered, without one an address beyond its area gives -2.
+
+    @returns   bytes, 0 if there is no card or it is not supported
+*/
+/**************************************************************************/
+unsigned int DFRNFC::dataCapacity(void)
+{
+    if(!sessionready())
+        return 0;
+    int capacity = datacapacity();
+    return (capacity < 0) ? 0 : capacity;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  dataCapacity of the card of the current session. It is kept
+            for the session, so a Type 2 Tag's CC is read only once per
+            card and not before every access
+
+    @returns   bytes, -4 if the capability container could not be read
+*/
+/**************************************************************************/
+int DFRNFC::datacapacity(void)
+{
+    if(_capacityGeneration == _generation)
+        return _capacity;
+
+    unsigned int capacity = 0;    // ISO14443-4 or unknown
+    if(_selRes & PN532_SAK_MIFARE_CLASSIC)
+        capacity = (_selRes & PN532_SAK_MIFARE_4K) ? PN532_MIFARE_4K_DATA : PN532_MIFARE_1K_DATA;
+    else if(_selRes == 0)
+    {
+        // Type 2 Tag, CC: magic number, version, data area size / 8, access conditions
+        if(!mifareultralight_ReadPages(3, data))
+            return -4;    // not kept, the next access tries again
+        if(data[0] == 0xE1)
+            capacity = data[2] * 8;
+        if(capacity > PN532_TYPE2_MAX_DATA)
+            capacity = PN532_TYPE2_MAX_DATA;
+    }
+    _capacity = capacity;
+    _capacityGeneration = _generation;
+    return capacity;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  The block that holds bytes index*16 .. index*16+15 of the
+            Mifare Classic data area, skipping block 0 and the trailers
+*/
+/**************************************************************************/
+uint8_t DFRNFC::datablock(unsigned int index)
+{
+    if(index < 47)
+        return DATABLOCKADDR(index);
+    if(index < 95)
+        return 64 + (index-47)/3*4 + (index-47)%3;   // sectors 16 - 31, 3 data blocks
+    return 128 + (index-95)/15*16 + (index-95)%15;   // sectors 32 - 39, 15 data blocks
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Moves a range of the data area block by block between the
+            card and the callback. Mifare Classic blocks go through
+            blockaccess, a sector is authenticated once; Type 2 Tags are
+            read 4 pages at a time and written page by page
+
+    @param  writing   0 to pass the card data to the callback, 1 to
+                      write what the callback fills in
+*/
+/**************************************************************************/
+int DFRNFC::streamdata(unsigned int byteAddrStart, unsigned int length, PN532ChunkCallback callback, void *context, boolean writing)
+{
+    if(length == 0 || byteAddrStart >= PN532_MIFARE_4K_DATA || length > PN532_MIFARE_4K_DATA - byteAddrStart)
+    {
+       _lastError = PN532_ERROR_RANGE;
+       return -1;   // beyond every card
+    }
+    if(!sessionready())  // no card, or it may have left the field
+       return -2;
+    int capacity = datacapacity();
+    if(capacity < 0)
+       return capacity;
+    if(byteAddrStart >= (unsigned int)capacity || length > capacity - byteAddrStart)
+    {
+       _lastError = PN532_ERROR_RANGE;
+       return -1;   // without range
+    }
+
+    boolean classic = _selRes & PN532_SAK_MIFARE_CLASSIC;
+    unsigned int byteAddrEnd = byteAddrStart + length;
+    uint8_t chunk[16];
+    for(unsigned int byteAddr = byteAddrStart; byteAddr < byteAddrEnd; )
+    {
+        uint8_t numByte = byteAddr%16;
+        uint8_t len = 16 - numByte;
+        if(len > byteAddrEnd - byteAddr)
+            len = byteAddrEnd - byteAddr;
+
+        if(writing && !callback(byteAddr, chunk, len, context))
+            return 0;
+        if(classic)
+        {
+            int result = writing ? blockaccess(datablock(byteAddr/16), chunk, numByte, len)
+                                 : blockaccess(datablock(byteAddr/16));
+            if(result < 0)
+                return result;
+        }
+        else
+        {
+            uint8_t page = 4 + byteAddr/16*4;
+            // a write only needs the old content around partial pages
+            if((!writing || numByte%4 || len%4) && !mifareultralight_ReadPages(page, data))
+                return -4;
+            if(writing)
+            {
+                memcpy(data+numByte, chunk, len);
+                for(uint8_t i = numByte/4; i <= (numByte+len-1)/4; i++)
+                {
+                    if(!mifareultralight_WritePage(page+i, data+i*4))
+                        return -5;
+                }
+            }
+            _cardContact = millis();
+        }
+        if(!writing && !callback(byteAddr, data+numByte, len, context))
+            return 0;
+        byteAddr += len;
+    }
+    return 1;
+}
+
+
+/**************************************************************************/
+/*! 
+    @brief  Makes sure read and write talk to the card in the field. A
+            session that was idle longer than the session timeout is
+            checked first, so a card swapped in the meantime is not
+            mistaken for the old one
+
+    @returns  1 if there is a card session
+*/
+/**************************************************************************/
+boolean DFRNFC::sessionready(void)
+{
+    if(fS50found && (millis() - _cardContact) < _sessionTimeout)
+        return 1;
+    return checkSession() != PN532_SESSION_NONE;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Authenticates and reads a data block into data, then changes
+            and writes it back if update is given. A block that is
+            overwritten completely is not read first. Failures are retried
+            as the retry policy says, with the adaptive timeout if set
+
+    @param  block     The block number
+    @param  update    Bytes to write into the block, 0 to only read it
+    @param  offset    Where they go in the block
+    @param  len       How many there are
+    
+    @returns   -3   if authentication failed
+               -4   if failed to read the block
+               -5   if failed to write the block
+               1    if succeed
+*/
+/**************************************************************************/
+int DFRNFC::blockaccess(uint8_t block, const uint8_t *update, uint8_t offset, uint8_t len)
+{
+    if(_retryPolicy.latencyFactor && _latencyAverage)
+    {
+        uint32_t timeout = (_latencyAverage/1000 + 1) * _retryPolicy.latencyFactor;
+        if(timeout < _retryPolicy.minTimeout)
+            timeout = _retryPolicy.minTimeout;
+        if(timeout > _retryPolicy.maxTimeout)
+            timeout = _retryPolicy.maxTimeout;
+        _serial->setTimeout(timeout);
+    }
+
+    int8_t result = blockattempt(block, update, offset, len);
+    if(result < 0)
+    {
+        _retryStats.failures++;
+        uint8_t tier = PN532_TIER_REAUTH;
+        uint8_t attempt = 0;
+        boolean replaced = 0;    // another card answered the listing
+        while(result < 0 && tier < PN532_TIERS)
+        {
+            uint8_t attempts = (tier == PN532_TIER_REAUTH) ? _retryPolicy.reauth :
+                               (tier == PN532_TIER_RESELECT) ? _retryPolicy.reselect : _retryPolicy.relist;
+            // a rejected key halts the card, authenticating alone cannot help
+            if(attempt >= attempts || (tier == PN532_TIER_REAUTH && _lastError == PN532_ERROR_AUTH))
+            {
+                tier++;
+                attempt = 0;
+                continue;
+            }
+            attempt++;
+
+            if(tier == PN532_TIER_RESELECT && !inSelect(1))
+                continue;
+            if(tier == PN532_TIER_RELIST)
+            {
+                uint8_t uid[7];
+                uint8_t uidLen = uidLength;
+                memcpy(uid, _uid, uidLen);    // listing overwrites _uid
+                if(!readPassiveTargetID(PN532_MIFARE_ISO14443A, _uid, &uidLength))
+                    continue;
+                if(uidLen != uidLength || memcmp(uid, _uid, uidLen))
+                {
+                    replaced = 1;    // another card, it is not ours to recover
+                    break;
+                }
+            }
+            result = blockattempt(block, update, offset, len);
+        }
+        if(result >= 0)
+            _retryStats.recovered[tier]++;
+        else if(!replaced)    // a new card keeps the session readPassiveTargetID started
+        {
+            _retryStats.unrecovered++;
+            if(result == -3)
+                fS50found = 0; //if failed to authenticate try to research a mifare card.
+        }
+    }
+
+    _serial->setTimeout(PN532_TIMEOUT);
+    return result;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  mifareclassic_AuthenticateBlock with a key stored in PROGMEM
+*/
+/**************************************************************************/
+uint8_t DFRNFC::authenticate_P(uint8_t *uid, uint8_t uidLen, uint32_t blockNumber, uint8_t keyNumber, const uint8_t *keyData)
+{
+    uint8_t key[6];
+    memcpy_P(key, keyData, 6);
+    return mifareclassic_AuthenticateBlock(uid, uidLen, blockNumber, keyNumber, key);
+}
+
+/**************************************************************************/
+/*! 
+    @brief  One try of blockaccess, without recovery. The sector stays
+            authenticated for the next block until another
+            authentication, a new listing or a failure
+*/
+/**************************************************************************/
+int8_t DFRNFC::blockattempt(uint8_t block, const uint8_t *update, uint8_t offset, uint8_t len)
+{
+    uint8_t sector = (block < 128) ? block/4 : 32 + (block-128)/16;
+    if(sector != _authSector)
+    {
+        if(!authenticate_P (_uid, uidLength, block, 1, keyuniversal)) //authen the block
+            return -3;
+        _authSector = sector;
+    }
+    // a failed read or write halts the card, it has to authenticate again
+    if(!(update && offset == 0 && len == 16) && !mifareclassic_ReadDataBlock(block, data)) //read block, unless all of it changes
+    {
+        _authSector = PN532_NOSECTOR;
+        return -4;
+    }
+    if(update)
+    {
+        memcpy(data+offset, update, len);
+        if(!mifareclassic_WriteDataBlock(block, data)) //write the block
+        {
+            _authSector = PN532_NOSECTOR;
+            return -5;
+        }
+    }
+    _cardContact = millis();
+    return 1;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  try to find the PN532& Mifare Classic card
+
+    @returns   -1   if failed to find pn532
+               -2   if failed to find a Mifare Classic card
+               1    if succeed
+*/
+/**************************************************************************/
+int DFRNFC::availinfo()
+{
+    int result = available();
+    if(result == -1)
+    {
+        _serial->println(F("version failed"));
+        return -1;
+    }
+    
+    if(result == -2)
+    {
+        _serial->println(F("card failed"));
+        return -2;
+    }    
+      // Got ok data, print it out!
+    _serial->print(F("Found chip PN5")); _serial->println(_firmware[0],HEX);
+    _serial->print(F("Firmware ver.")); _serial->print(_firmware[1],DEC);
+    _serial->print('.'); _serial->println(_firmware[2], DEC);
+    return 1;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  try to find the PN532& Mifare Classic card
+
+            The PN532 is only configured and probed once; after that the
+            ACK of the list command shows it is alive. A missing ACK
+            means it may have been reset, then the full initialisation
+            runs again before the card is looked for once more.
+
+    @returns   -1   if failed to find pn532
+               -2   if failed to find a Mifare Classic card
+               1    if succeed
+*/
+/**************************************************************************/
+int DFRNFC::available()
+{
+    if(!_initialized && !initchip())
+        return -1;
+    if(!readPassiveTargetID(PN532_MIFARE_ISO14443A, _uid, &uidLength))
+    {
+        if(_initialized)
+            return -2;    // the PN532 answered, there is no card
+        PN532_COUNT(retries);
+        if(!initchip())
+            return -1;
+        if(!readPassiveTargetID(PN532_MIFARE_ISO14443A, _uid, &uidLength))
+            return -2;
+    }
+    return 1;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Configures the PN532 and caches its firmware version
+
+    @returns   1 if the PN532 answered both commands
+*/
+/**************************************************************************/
+boolean DFRNFC::initchip(void)
+{
+    _initialized = SAMConfig() && getFirmwareVersion(_firmware);
+    return _initialized;
+}
+
+
+/***** Scan Pipeline ******/
+
+/**************************************************************************/
+/*! 
+    @brief  Configures the scan pipeline once: the blocks to read from
+            every card and the function that gets them
+
+    @param  ranges    Blocks to read, they are not copied and have to
+                      stay valid
+    @param  count     Number of ranges
+    @param  buffer    Receives the blocks of all ranges in order
+    @param  size      Buffer size, at least 16 bytes per block
+    @param  callback  Called with the uid and the data of every card
+    @param  context   Passed to the callback
+    
+    @returns  1 if the buffer is large enough for the ranges
+*/
+/**************************************************************************/
+boolean DFRNFC::setScan(const PN532ScanRange *ranges, uint8_t count, uint8_t *buffer, uint16_t size, PN532ScanCallback callback, void *context)
+{
+    uint32_t length = 0;    // 255 ranges of 256 blocks do not fit 16 bits
+    for(uint8_t i=0; i<count; i++)
+    {
+        if(ranges[i].block + ranges[i].blocks > 256)
+        {
+            _lastError = PN532_ERROR_RANGE;
+            return 0;
+        }
+        length += ranges[i].blocks * 16UL;
+    }
+    if(length > size || !callback)
+    {
+        _lastError = PN532_ERROR_RANGE;
+        return 0;
+    }
+    _scanRanges = ranges;
+    _scanCount = count;
+    _scanBuffer = buffer;
+    _scanLength = length;
+    _scanCallback = callback;
+    _scanContext = context;
+    _scanGeneration = _generation - 1;    // a card already in the field is new to the scan
+    return 1;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Runs the scan pipeline once: looks for a card, reads the
+            configured blocks with one authentication per sector and
+            passes them to the callback. A card is reported once per
+            tap, it has to leave the field (or another card come) before
+            it is reported again. Call it from loop.
+
+    @returns   1    if a card was read and reported
+               0    if the card in the field was reported already
+               -1   if failed to find pn532 or the scan is not set up
+               -2   if there is no card
+               -3   if authentication failed
+               -4   if failed to read a block
+*/
+/**************************************************************************/
+int8_t DFRNFC::scan(void)
+{
+    if(!_scanCallback)
+        return -1;
+
+    uint32_t start = micros();
+    _scanStats.polls++;
+    int8_t result = available();
+    if(result < 0)
+    {
+        fS50found = 0;    // the card left, its next tap is a new one
+        scantime(start);
+        return result;
+    }
+    if(_generation == _scanGeneration)
+    {
+        scantime(start);
+        return 0;
+    }
+
+    uint8_t *out = _scanBuffer;
+    for(uint8_t i=0; i<_scanCount && result > 0; i++)
+    {
+        const PN532ScanRange *range = &_scanRanges[i];
+        for(uint8_t j=0; j<range->blocks; j++)
+        {
+            uint8_t block = range->block + j;
+            // the first block of a range or a sector needs the key
+            if((j == 0 || mifareclassic_IsFirstBlock(block)) &&
+               !mifareclassic_AuthenticateBlock(_uid, uidLength, block, range->keyNumber, (uint8_t *)range->key))
+            {
+                result = -3;
+                break;
+            }
+            if(!mifareclassic_ReadDataBlock(block, out))
+            {
+                result = -4;
+                break;
+            }
+            out += 16;
+        }
+    }
+    if(result < 0)
+    {
+        // a failed authentication halts the card, list it as new next time
+        fS50found = 0;
+        _scanStats.failures++;
+        scantime(start);
+        return result;
+    }
+
+    _cardContact = millis();
+    _scanGeneration = _generation;
+    _scanStats.taps++;
+    scantime(start);
+    _scanCallback(_uid, uidLength, _scanBuffer, _scanLength, _scanContext);
+    return 1;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Clears the counters of the scan pipeline
+*/
+/**************************************************************************/
+void DFRNFC::resetScanStats(void)
+{
+    memset (&_scanStats, 0, sizeof(_scanStats));
+    _scanMicros = 0;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Adds the time since start to the scan counters. The
+            microseconds are carried over to millis, so the total does
+            not wrap after 71 minutes like micros() does.
+
+    @param  start  micros() at the beginning of the scan
+*/
+/**************************************************************************/
+void DFRNFC::scantime(uint32_t start)
+{
+    uint32_t elapsed = micros() - start + _scanMicros;
+    _scanStats.millis += elapsed / 1000;
+    _scanMicros = elapsed % 1000;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Sustained rate of the scan pipeline, counting the time spent
+            in scan since the counters were cleared
+
+    @returns  Cards per second, 0 before the first card
+*/
+/**************************************************************************/
+uint32_t DFRNFC::tapsPerSecond(void)
+{
+    uint32_t taps = _scanStats.taps;
+    uint32_t ms = _scanStats.millis;
+
+    if(!ms)
+        return 0;
+    // taps * 1000 overflows 32 bits after 4 million cards, then whole
+    // seconds are exact enough; no float or 64-bit division on AVR
+    if(taps <= 0xFFFFFFFFUL / 1000)
+        return taps * 1000 / ms;
+    return taps / (ms / 1000);
+}
+
+
+/**************************************************************************/
+/*! 
+    @brief  try to dump the Mifare Classic card mem
+*/
+/**************************************************************************/
+void DFRNFC::memdump(void)
+{
+    _serial->println(F("Start memdump"));
+    for(int i=0;i<64;i++)
+    {
+      if(!authenticate_P (_uid, uidLength, i, 1, keyuniversal))
+      {
+        _serial->print(F("Block "));_serial->print(i,DEC);_serial->print(F(":  "));
+        _serial->println(F("failed to authen"));
+      }
+      else
+      {
+        if(!mifareclassic_ReadDataBlock(i,data))
+        {
+          _serial->print(F("Block "));_serial->print(i,DEC);_serial->print(F(":  "));
+          _serial->println(F("failed to read"));
+        }
+        else
+        {
+          _serial->print(F("Block ")); _serial->print(i,DEC);_serial->print(F(":  "));
+          PrintHexChar(data,16);
+        }
+      }
+    }
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Prints a hexadecimal value in plain characters
+
+    @param  data      Pointer to the byte data
+    @param  numBytes  Data length in bytes
+*/
+/**************************************************************************/
+void DFRNFC::PrintHex(const byte * data, const uint32_t numBytes)
+{
+  uint32_t szPos;
+  for (szPos=0; szPos < numBytes; szPos++) 
+  {
+    _serial->print(F("0x"));
+    // Append leading 0 for small values
+    if (data[szPos] <= 0xF)
+      _serial->print('0');
+    _serial->print(data[szPos], HEX);
+    if ((numBytes > 1) && (szPos != numBytes - 1))
+    {
+      _serial->print(' ');
+    }
+  }
+  _serial->println();
+}
+
+
+
+/**************************************************************************/
+/*! 
+    @brief  Prints a hexadecimal value in plain characters, along with
+            the char equivalents in the following format
+
+            00 00 00 00 00 00  ......
+
+    @param  data      Pointer to the byte data
+    @param  numBytes  Data length in bytes
+*/
+/**************************************************************************/
+void DFRNFC::PrintHexChar(const byte * data, const uint32_t numBytes)
+{
+  uint32_t szPos;
+  for (szPos=0; szPos < numBytes; szPos++) 
+  {
+    // Append leading 0 for small values
+    if (data[szPos] <= 0xF)
+      _serial->print('0');
+    _serial->print(data[szPos], HEX);
+    if ((numBytes > 1) && (szPos != numBytes - 1))
+    {
+      _serial->print(' ');
+    }
   }
-  else if (len == 7)
+  _serial->print(F("  "));
+  for (szPos=0; szPos < numBytes; szPos++) 
   {
-    // 0xFE needs to be wrapped around to next block
-    memcpy (sectorbuffer1+9, url, len);
-    sectorbuffer2[0] = 0xFE;
+    if (data[szPos] <= 0x1F)
+      _serial->print('.');
+    else
+      _serial->print(data[szPos]);
   }
-  else if ((len > 7) || (len <= 22))
+  _serial->println();
+}
+ 
+
+
+/***** NDEF Parser ******/
+
+NDEFParser::NDEFParser(uint8_t *buf, uint16_t size)
+{
+  _buf = buf;
+  _size = size;
+  reset();
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Forgets any parsed data so a new tag can be fed in
+*/
+/**************************************************************************/
+void NDEFParser::reset(void)
+{
+  _state = NDEF_STATE_TYPE;
+  _tlvType = NDEF_TLV_NULL;
+  _tlvLength = 0;
+  _tlvPos = 0;
+  _msgLength = 0;
+  _recordPos = 0;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Called once the length of a TLV is known
+*/
+/**************************************************************************/
+int8_t NDEFParser::beginValue(void)
+{
+  _tlvPos = 0;
+  if (_tlvType == NDEF_TLV_MESSAGE)
   {
-    // Url fits in two blocks
-    memcpy (sectorbuffer1+9, url, 7);
-    memcpy (sectorbuffer2, url+7, len-7);
-    sectorbuffer2[len-7] = 0xFE;
+    if (_tlvLength > _size)
+      return NDEF_PARSE_OVERFLOW;
+    _msgLength = _tlvLength;
   }
-  else if (len == 23)
+  if (_tlvLength == 0)
   {
-    // 0xFE needs to be wrapped around to final block
-    memcpy (sectorbuffer1+9, url, 7);
-    memcpy (sectorbuffer2, url+7, len-7);
-    sectorbuffer3[0] = 0xFE;
+    _state = (_tlvType == NDEF_TLV_MESSAGE) ? NDEF_STATE_DONE : NDEF_STATE_TYPE;
+    return (_state == NDEF_STATE_DONE) ? NDEF_PARSE_DONE : NDEF_PARSE_MORE;
+  }
+  _state = NDEF_STATE_VALUE;
+  return NDEF_PARSE_MORE;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Consumes the next bytes of the tag's data area
+
+    @param  data      Pointer to the bytes read from the tag
+    @param  len       Number of bytes
+    
+    @returns  NDEF_PARSE_DONE when the message is complete,
+              NDEF_PARSE_MORE when more data is needed,
+              NDEF_PARSE_OVERFLOW if the message does not fit the buffer
+*/
+/**************************************************************************/
+int8_t NDEFParser::feed(const uint8_t *data, uint8_t len)
+{
+  int8_t result = NDEF_PARSE_MORE;
+
+  for (uint8_t i = 0; i < len; i++)
+  {
+    uint8_t b = data[i];
+
+    switch (_state)
+    {
+      case NDEF_STATE_TYPE:
+        if (b == NDEF_TLV_NULL)
+          break;
+        if (b == NDEF_TLV_TERMINATOR)
+        {
+          _state = NDEF_STATE_DONE;
+          return NDEF_PARSE_DONE;
+        }
+        _tlvType = b;
+        _state = NDEF_STATE_LENGTH;
+        break;
+
+      case NDEF_STATE_LENGTH:
+        if (b == 0xFF)
+        {
+          // three byte length format
+          _state = NDEF_STATE_LENGTH_HI;
+          break;
+        }
+        _tlvLength = b;
+        result = beginValue();
+        break;
+
+      case NDEF_STATE_LENGTH_HI:
+        _tlvLength = (uint16_t)b << 8;
+        _state = NDEF_STATE_LENGTH_LO;
+        break;
+
+      case NDEF_STATE_LENGTH_LO:
+        _tlvLength |= b;
+        result = beginValue();
+        break;
+
+      case NDEF_STATE_VALUE:
+      {
+        // take as much of the value as this chunk holds in one go
+        uint16_t n = _tlvLength - _tlvPos;
+        if (n > (uint16_t)(len - i))
+          n = len - i;
+        if (_tlvType == NDEF_TLV_MESSAGE)
+          memcpy (_buf+_tlvPos, data+i, n);
+        _tlvPos += n;
+        i += n - 1;
+        if (_tlvPos == _tlvLength)
+        {
+          // only the first message is of interest
+          if (_tlvType == NDEF_TLV_MESSAGE)
+          {
+            _state = NDEF_STATE_DONE;
+            return NDEF_PARSE_DONE;
+          }
+          _state = NDEF_STATE_TYPE;
+        }
+        break;
+      }
+
+      case NDEF_STATE_DONE:
+        return NDEF_PARSE_DONE;
+    }
+
+    if (result != NDEF_PARSE_MORE)
+      return result;
+  }
+
+  return NDEF_PARSE_MORE;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Walks the records of a completely parsed message
+
+    @param  record    Filled with the next record, its fields point into
+                      the message buffer
+    
+    @returns  1 if a record was returned, 0 at the end of the message or
+              if the record is malformed
+*/
+/**************************************************************************/
+boolean NDEFParser::nextRecord(NDEFRecord *record)
+{
+  if (_state != NDEF_STATE_DONE || _recordPos >= _msgLength)
+    return 0;
+
+  const uint8_t *p = _buf + _recordPos;
+  uint16_t remain = _msgLength - _recordPos;
+  uint16_t pos = 2;
+
+  if (remain < 3)
+    return 0;
+
+  record->header = p[0];
+  record->typeLength = p[1];
+  if (record->header & NDEF_RECORD_SR)
+  {
+    record->payloadLength = p[2];
+    pos += 1;
   }
   else
   {
-    // Url fits in three blocks
-    memcpy (sectorbuffer1+9, url, 7);
-    memcpy (sectorbuffer2, url+7, 16);
-    memcpy (sectorbuffer3, url+23, len-24);
-    sectorbuffer3[len-22] = 0xFE;
+    if (remain < 6)
+      return 0;
+    record->payloadLength = ((uint32_t)p[2] << 24) | ((uint32_t)p[3] << 16) | ((uint16_t)p[4] << 8) | p[5];
+    pos += 4;
   }
-  
-  // Now write all three blocks back to the card
-  if (!(mifareclassic_WriteDataBlock (sectorNumber*4, sectorbuffer1)))
+  record->idLength = 0;
+  if (record->header & NDEF_RECORD_IL)
+  {
+    if (pos >= remain)
+      return 0;
+    record->idLength = p[pos++];
+  }
+
+  // the whole record must lie inside the message, checked piece by
+  // piece so a huge payload length cannot wrap the sum
+  if ((record->payloadLength > remain) ||
+      ((uint32_t)pos + record->typeLength + record->idLength + record->payloadLength > remain))
     return 0;
-  if (!(mifareclassic_WriteDataBlock ((sectorNumber*4)+1, sectorbuffer2)))
+
+  record->type = p + pos;
+  pos += record->typeLength;
+  record->id = p + pos;
+  pos += record->idLength;
+  record->payload = p + pos;
+  pos += record->payloadLength;
+
+  _recordPos += pos;
+  return 1;
+}
+
+
+/**************************************************************************/
+/*! 
+    @brief  Expands a uri identifier code to the prefix it stands for
+
+    @param  uriIdentifier The first payload byte of a URI record
+    @param  buffer        Receives the '\0' terminated prefix
+    @param  size          Size of buffer, 27 bytes fit any prefix
+    
+    @returns  Length of the prefix, 0 for unknown codes or if buffer is
+              too small
+*/
+/**************************************************************************/
+uint8_t NDEFParser::decodeUriPrefix(uint8_t uriIdentifier, char *buffer, uint8_t size)
+{
+  PGM_P prefix = uriPrefixTable;
+
+  if (size > 0)
+    buffer[0] = '\0';
+  if (uriIdentifier >= NDEF_URIPREFIX_COUNT)
     return 0;
-  if (!(mifareclassic_WriteDataBlock ((sectorNumber*4)+2, sectorbuffer3)))
+
+  for (uint8_t code = 0; code < uriIdentifier; code++)
+    prefix += strlen_P(prefix) + 1;
+
+  uint8_t len = strlen_P(prefix);
+  if (len >= size)
+    return 0;
+  memcpy_P(buffer, prefix, len + 1);
+  return len;
+}
+
+
+/***** NDEF Message ******/
+
+NDEFMessage::NDEFMessage(uint8_t *buf, uint16_t size)
+{
+  _buf = buf;
+  _size = size;
+  reset();
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Empties the message
+*/
+/**************************************************************************/
+void NDEFMessage::reset(void)
+{
+  _length = 0;
+  _lastHeader = 0;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Writes the header and type of a new record and links it to
+            the previous one. The caller appends the payload.
+*/
+/**************************************************************************/
+boolean NDEFMessage::beginRecord(uint8_t tnf, const uint8_t *type, uint8_t typeLength, uint32_t payloadLength)
+{
+  boolean shortRecord = (payloadLength < 256);
+  uint32_t total = 2 + (shortRecord ? 1 : 4) + typeLength + payloadLength;
+
+  if ((uint32_t)_length + total > _size)
     return 0;
-  if (!(mifareclassic_WriteDataBlock ((sectorNumber*4)+3, sectorbuffer4)))
+
+  uint8_t header = NDEF_RECORD_ME | (tnf & NDEF_RECORD_TNF_MASK);
+  if (_length == 0)
+    header |= NDEF_RECORD_MB;
+  else
+    _buf[_lastHeader] &= ~NDEF_RECORD_ME;  // previous record is no longer the last
+  if (shortRecord)
+    header |= NDEF_RECORD_SR;
+
+  _lastHeader = _length;
+  _buf[_length++] = header;
+  _buf[_length++] = typeLength;
+  if (!shortRecord)
+  {
+    _buf[_length++] = 0;
+    _buf[_length++] = 0;
+    _buf[_length++] = payloadLength >> 8;
+  }
+  _buf[_length++] = payloadLength & 0xFF;
+  memcpy (_buf+_length, type, typeLength);
+  _length += typeLength;
+  return 1;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Appends a record
+
+    @param  tnf           Type Name Format (NDEF_TNF_*)
+    @param  type          Pointer to the record type
+    @param  typeLength    Length of the record type
+    @param  payload       Pointer to the payload
+    @param  payloadLength Length of the payload
+    
+    @returns 1 if the record was added, 0 if the buffer is too small
+*/
+/**************************************************************************/
+boolean NDEFMessage::addRecord(uint8_t tnf, const uint8_t *type, uint8_t typeLength, const uint8_t *payload, uint16_t payloadLength)
+{
+  if (!beginRecord(tnf, type, typeLength, payloadLength))
     return 0;
+  memcpy (_buf+_length, payload, payloadLength);
+  _length += payloadLength;
+  return 1;
+}
 
-  // Seems that everything was OK (?!)
+/**************************************************************************/
+/*! 
+    @brief  Appends a well known URI record ("U")
+
+    @param  uriIdentifier The uri identifier code (NDEF_URIPREFIX_*)
+    @param  uri           The rest of the uri
+*/
+/**************************************************************************/
+boolean NDEFMessage::addUriRecord(uint8_t uriIdentifier, const char *uri)
+{
+  size_t len = strlen(uri);
+  if (!beginRecord(NDEF_TNF_WELL_KNOWN, (const uint8_t *)"U", 1, (uint32_t)len+1))
+    return 0;
+  _buf[_length++] = uriIdentifier;
+  memcpy (_buf+_length, uri, len);
+  _length += len;
   return 1;
 }
 
-/***** Mifare Ultralight Functions ******/
+/**************************************************************************/
+/*! 
+    @brief  Appends a well known URI record ("U"), abbreviating the
+            longest known prefix of the uri to its identifier code
+
+    @param  uri           The complete uri, e.g. "https://www.dfrobot.com"
+*/
+/**************************************************************************/
+boolean NDEFMessage::addUriRecord(const char *uri)
+{
+  uint8_t prefixLength;
+  uint8_t uriIdentifier = encodeUriPrefix(uri, &prefixLength);
+  return addUriRecord(uriIdentifier, uri+prefixLength);
+}
 
 /**************************************************************************/
 /*! 
-    Tries to read an entire 4-byte page at the specified address.
+    @brief  Appends a well known UTF-8 text record ("T")
 
-    @param  page        The page number (0..63 in most cases)
-    @param  buffer      Pointer to the byte array that will hold the
-                        retrieved data (if any)
+    @param  text          The text
+    @param  language      IANA language code, "en" by default
 */
 /**************************************************************************/
-uint8_t DFRNFC::mifareultralight_ReadPage (uint8_t page, uint8_t * buffer)
+boolean NDEFMessage::addTextRecord(const char *text, const char *language)
 {
-  if (page >= 64)
-  {
-    #ifdef MIFAREDEBUG
-    _serial->println("Page value out of range");
-    #endif
+  size_t langLen = strlen(language);
+  size_t len = strlen(text);
+  if ((langLen > 0x3F) || !beginRecord(NDEF_TNF_WELL_KNOWN, (const uint8_t *)"T", 1, 1+langLen+(uint32_t)len))
     return 0;
-  }
+  _buf[_length++] = langLen;    // status byte, bit 7 clear for UTF-8
+  memcpy (_buf+_length, language, langLen);
+  _length += langLen;
+  memcpy (_buf+_length, text, len);
+  _length += len;
+  return 1;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Appends a MIME media record
 
-  #ifdef MIFAREDEBUG
-    _serial->print("Reading page ");_serial->println(page);
-  #endif
+    @param  mimeType      The media type, e.g. "text/plain"
+    @param  payload       Pointer to the payload
+    @param  payloadLength Length of the payload
+    
+    @returns 1 if the record was added, 0 if the buffer is too small
+             or the media type is longer than 255 characters
+*/
+/**************************************************************************/
+boolean NDEFMessage::addMimeRecord(const char *mimeType, const uint8_t *payload, uint16_t payloadLength)
+{
+  size_t len = strlen(mimeType);
+  if (len > 255)    // the type length is one byte
+    return 0;
+  return addRecord(NDEF_TNF_MIME_MEDIA, (const uint8_t *)mimeType, len, payload, payloadLength);
+}
 
-  /* Prepare the command */
-  pn532_packetbuffer[0] = PN532_COMMAND_INDATAEXCHANGE;
-  pn532_packetbuffer[1] = 1;                   /* Card number */
-  pn532_packetbuffer[2] = MIFARE_CMD_READ;     /* Mifare Read command = 0x30 */
-  pn532_packetbuffer[3] = page;                /* Page Number (0..63 in most cases) */
+/**************************************************************************/
+/*! 
+    @brief  Finds the uri identifier code with the longest prefix
+            matching the start of the uri
 
-  /* Send the command */
-  if (! sendCommandCheckAck(pn532_packetbuffer, 4))
+    @param  uri           The complete uri
+    @param  prefixLength  Set to the number of characters the code
+                          stands for
+    
+    @returns  The uri identifier code, NDEF_URIPREFIX_NONE if no
+              prefix matches
+*/
+/**************************************************************************/
+uint8_t NDEFMessage::encodeUriPrefix(const char *uri, uint8_t *prefixLength)
+{
+  PGM_P prefix = uriPrefixTable;
+  uint8_t best = NDEF_URIPREFIX_NONE;
+  uint8_t bestLength = 0;
+
+  for (uint8_t code = 0; code < NDEF_URIPREFIX_COUNT; code++)
   {
-    #ifdef MIFAREDEBUG
-    _serial->println("Failed to receive ACK for write command");
-    #endif
-    return 0;
+    uint8_t len = strlen_P(prefix);
+    if ((len > bestLength) && (strncmp_P(uri, prefix, len) == 0))
+    {
+      best = code;
+      bestLength = len;
+    }
+    prefix += len + 1;
   }
-  
-  /* Read the response packet */
-  readdata(pn532_packetbuffer, 26);
-  #ifdef MIFAREDEBUG
-    _serial->println("Received: ");
-    DFRNFC::PrintHexChar(pn532_packetbuffer, 26);
-  #endif
 
-  /* If byte 8 isn't 0x00 we probably have an error */
-  if (pn532_packetbuffer[7] == 0x00)
+  *prefixLength = bestLength;
+  return best;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Size of the NDEF message TLV plus the terminator TLV
+*/
+/**************************************************************************/
+uint16_t NDEFMessage::tlvLength(void)
+{
+  return ((_length < 0xFF) ? 2 : 4) + _length + 1;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Byte at the given offset of the TLV stream, zero past its end
+*/
+/**************************************************************************/
+uint8_t NDEFMessage::tlvByte(uint16_t offset)
+{
+  uint8_t head = (_length < 0xFF) ? 2 : 4;
+
+  if (offset == 0)
+    return NDEF_TLV_MESSAGE;
+  if (offset < head)
   {
-    /* Copy the 4 data bytes to the output buffer         */
-    /* Block content starts at byte 9 of a valid response */
-    /* Note that the command actually reads 16 byte or 4  */
-    /* pages at a time ... we simply discard the last 12  */
-    /* bytes                                              */
-    memcpy (buffer, pn532_packetbuffer+8, 4);
+    if (head == 2)
+      return _length;
+    if (offset == 1)
+      return 0xFF;    // three byte length format
+    return (offset == 2) ? (_length >> 8) : (_length & 0xFF);
   }
+  offset -= head;
+  if (offset < _length)
+    return _buf[offset];
+  return (offset == _length) ? NDEF_TLV_TERMINATOR : 0x00;
+}
+
+
+
+/***** Trace Buffer ******/
+
+PN532TraceBuffer::PN532TraceBuffer(PN532TraceEntry *entries, uint8_t size)
+{
+  _entries = entries;
+  _size = size;
+  clear();
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Drops all recorded entries
+*/
+/**************************************************************************/
+void PN532TraceBuffer::clear(void)
+{
+  _head = 0;
+  _count = 0;
+  _dropped = 0;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Trace hook that stores the event, the context is the
+            PN532TraceBuffer to record into
+
+    @param  event     The event to record
+    @param  context   The PN532TraceBuffer
+*/
+/**************************************************************************/
+void PN532TraceBuffer::record(const PN532TraceEvent *event, void *context)
+{
+  PN532TraceBuffer *buffer = (PN532TraceBuffer *)context;
+  if (buffer->_size == 0)
+    return;
+
+  PN532TraceEntry *entry = &buffer->_entries[buffer->_head];
+  uint16_t len = event->len + event->bodylen;
+  entry->type = event->type;
+  entry->command = event->command;
+  entry->error = event->error;
+  entry->len = (len > 0xFF) ? 0xFF : len;
+  entry->micros = event->micros;
+
+  uint8_t n = 0;
+  for (uint16_t i = 0; (i < event->len) && (n < PN532_TRACE_DATA); i++)
+    entry->data[n++] = event->data[i];
+  for (uint16_t i = 0; (i < event->bodylen) && (n < PN532_TRACE_DATA); i++)
+    entry->data[n++] = event->body[i];
+  while (n < PN532_TRACE_DATA)
+    entry->data[n++] = 0;
+
+  if (++buffer->_head == buffer->_size)
+    buffer->_head = 0;
+  if (buffer->_count < buffer->_size)
+    buffer->_count++;
   else
-  {
-    #ifdef MIFAREDEBUG
-      _serial->println("Unexpected response reading block: ");
-      DFRNFC::PrintHexChar(pn532_packetbuffer, 26);
-    #endif
-    return 0;
-  }
+    buffer->_dropped++;
+}
 
-  /* Display data for debug if requested */
-  #ifdef MIFAREDEBUG
-    _serial->print("Page ");_serial->print(page);_serial->println(":");
-    DFRNFC::PrintHexChar(buffer, 4);
-  #endif
+/**************************************************************************/
+/*! 
+    @brief  Returns a recorded entry
 
-  // Return OK signal
-  return 1;
+    @param  index     0 for the oldest entry, up to count()-1
+
+    @returns  The entry, or 0 if index is out of range
+*/
+/**************************************************************************/
+const PN532TraceEntry *PN532TraceBuffer::entry(uint8_t index)
+{
+  if (index >= _count)
+    return 0;
+
+  uint16_t i = (uint16_t)_head + _size - _count + index;
+  return &_entries[i % _size];
 }
 
 
 
+/***** Wire Capture ******/
+
+// Command names for PN532Capture::decode, each behind its command code
+const char commandNameTable[] PROGMEM =
+  "\x02" "GetFirmwareVersion\0"
+  "\x06" "ReadRegister\0"
+  "\x08" "WriteRegister\0"
+  "\x12" "SetParameters\0"
+  "\x14" "SAMConfiguration\0"
+  "\x16" "PowerDown\0"
+  "\x32" "RFConfiguration\0"
+  "\x40" "InDataExchange\0"
+  "\x42" "InCommunicateThru\0"
+  "\x44" "InDeselect\0"
+  "\x46" "InJumpForPSL\0"
+  "\x4A" "InListPassiveTarget\0"
+  "\x4E" "InPSL\0"
+  "\x52" "InRelease\0"
+  "\x54" "InSelect\0"
+  "\x56" "InJumpForDEP\0"
+  "\x86" "TgGetData\0"
+  "\x8C" "TgInitAsTarget\0"
+  "\x8E" "TgSetData\0"
+;
 
+PN532Capture::PN532Capture(uint8_t *buf, uint16_t size, uint16_t used)
+{
+  _buf = buf;
+  _size = size;
+  clear();
+  _length = (used < size) ? used : size;
+}
 
 /**************************************************************************/
 /*! 
-    @brief  Tries to read the  ACK signal
+    @brief  Drops all captured records
 */
 /**************************************************************************/
-boolean DFRNFC::readack() {
-  uint8_t ackbuff[6];
-  readdata(ackbuff, 6);
-  return (0 == strncmp((char *)ackbuff, (char *)pn532ack, 6));
+void PN532Capture::clear(void)
+{
+  _start = 0;
+  _length = 0;
+  _dropped = 0;
 }
 
+/**************************************************************************/
+/*! 
+    @brief  Returns a captured byte
+
+    @param  offset    Byte offset, 0 is the first byte of the oldest record
 
-int8_t DFRNFC::readdata(uint8_t* buff, uint8_t len) 
+    @returns  The byte, 0 past the end of the capture
+*/
+/**************************************************************************/
+uint8_t PN532Capture::byteAt(uint16_t offset)
 {
-    _serial->readBytes(buff,len);
+  if (offset >= _length)
     return 0;
+  return _buf[((uint32_t)_start + offset) % _size];
 }
 
 /**************************************************************************/
 /*! 
-    @brief  Writes a command to the PN532, automatically inserting the
-            preamble and required frame details (checksum, len, etc.)
-
-    @param  cmd       Pointer to the command buffer
-    @param  cmdlen    Command length in bytes 
+    @brief  Appends a byte, the caller made room for it
 */
 /**************************************************************************/
-void DFRNFC::writecommand(uint8_t* cmd, uint8_t cmdlen)
+void PN532Capture::put(uint8_t b)
 {
-    uint8_t checksum;
-
-    cmdlen++;
-
-#ifdef PN532DEBUG
-    _serial->print("\nSending: ");
-#endif
-
-    checksum = 0;
-    _serial->write((uint8_t)PN532_PREAMBLE);
-    _serial->write((uint8_t)PN532_STARTCODE1);
-    _serial->write((uint8_t)PN532_STARTCODE2);
+  _buf[((uint32_t)_start + _length) % _size] = b;
+  _length++;
+}
 
-    _serial->write(cmdlen);
-    _serial->write(~cmdlen + 1);
+/**************************************************************************/
+/*! 
+    @brief  Trace hook that appends the event as a record, the context is
+            the PN532Capture to record into
 
-    _serial->write(PN532_HOSTTOPN532);
-    checksum += PN532_HOSTTOPN532;
+    @param  event     The event to record
+    @param  context   The PN532Capture
+*/
+/**************************************************************************/
+void PN532Capture::record(const PN532TraceEvent *event, void *context)
+{
+  PN532Capture *capture = (PN532Capture *)context;
+  uint16_t len = event->len + event->bodylen;
+  if ((event->type == PN532_TRACE_RX) || (event->type == PN532_TRACE_ERROR))
+    len++;      // response or error code in front
+  if (len > 0xFF)
+    len = 0xFF;
 
+  uint16_t need = PN532_CAPTURE_HEADER + len;
+  if (need > capture->_size)
+  {
+    capture->_dropped++;
+    return;
+  }
 
-    for (uint8_t i=0; i<cmdlen-1; i++) 
-    {
-        _serial->write(cmd[i]);
-        checksum += cmd[i];
-    }
-    
-    _serial->write(~checksum + 1);
-    _serial->write((uint8_t)PN532_POSTAMBLE);
+  // drop the oldest records until the new one fits
+  while (capture->_size - capture->_length < need)
+  {
+    uint16_t oldest = PN532_CAPTURE_HEADER + capture->byteAt(5);
+    capture->_start = ((uint32_t)capture->_start + oldest) % capture->_size;
+    capture->_length -= oldest;
+    capture->_dropped++;
+  }
 
+  capture->put(event->type);
+  for (uint8_t i = 0; i < 4; i++)
+    capture->put(event->micros >> (8*i));
+  capture->put(len);
 
-} 
+  if (event->type == PN532_TRACE_RX)
+  {
+    capture->put(event->command + 1);
+    len--;
+  }
+  else if (event->type == PN532_TRACE_ERROR)
+  {
+    capture->put(event->error);
+    len--;
+  }
+  for (uint16_t i = 0; (i < event->len) && (len > 0); i++, len--)
+    capture->put(event->data[i]);
+  for (uint16_t i = 0; (i < event->bodylen) && (len > 0); i++, len--)
+    capture->put(event->body[i]);
+}
 
 /**************************************************************************/
 /*! 
-    @brief  read bytes from data block, the address should be with the rage
-            of 0 - 752, from Bytes 0 of block 1 to Byte 16 of block 62 
+    @brief  Writes the raw records, oldest first, e.g. to save them to a
+            file for decoding or replay on a PC
 
-    @param  byteAddr    the address of the data to read. 16*47 data bytes  
-    
-    @returns   -1   if address is without the range
-               -2   if failed to find a Mifare Classic card card
-               -3   if authentication failed
-               -4   if failed to read block
-               data if succeed
+    @param  out       Where to write the capture
 */
 /**************************************************************************/
-int DFRNFC::read(unsigned int byteAddr)
-{   
-    if(byteAddr > 751)
-       return -1;   // without range
-    if(!fS50found)  // if no s50 card has been find
-    {
-       if(!readPassiveTargetID(PN532_MIFARE_ISO14443A, _uid, &uidLength)) //try to find one
-           return -2;
-    }
-    uint8_t numBlock = DataBlockAddr[byteAddr/16];
-    uint8_t numByte = byteAddr%16;
-/*     if(numBlock > 1)
-    {
-        uint8_t numSector = (numBlock - 2)/3 + 1;
-        numBlock = numSector*4 + (numBlock - 2)%3;
-    }
-    else numBlock++; */
-    if(!mifareclassic_AuthenticateBlock (_uid, uidLength, numBlock, 1, keyuniversal)) //authen the block
-    {
-        fS50found =0; //if failed to authenticate try to research a mifare card.
-        return -3;
-    }
-    if(!mifareclassic_ReadDataBlock(numBlock, data)) //read block
-        return -4;
-    return data[numByte]; //return data
+void PN532Capture::dump(Print &out)
+{
+  for (uint16_t i = 0; i < _length; i++)
+    out.write(byteAt(i));
 }
 
-
 /**************************************************************************/
 /*! 
-    @brief  read string from data block, the end address should be with the rage
-            of 0 - 752, from Bytes 0 of block 1 to Byte 16 of block 62 
+    @brief  Prints one line per record: the time since the previous
+            record, the record type, the command name and the data
 
-    @param  byteAddr    the address of the data to read. 16*47 data bytes  
-    
-    @returns   -1   if address is without the range
-               -2   if failed to find a Mifare Classic card card
-               -3   if authentication failed
-               -4   if failed to read block
-               data if succeed
+    @param  out       Where to print the capture
 */
 /**************************************************************************/
-int DFRNFC::readBytes(uint8_t* buff, unsigned int byteAddrStart, unsigned int length)
-{  
-    int byteAddrEnd = byteAddrStart +length -1; 
-    if(byteAddrEnd > 751)
-       return -1;   // without range
-    if(!fS50found)  // if no s50 card has been find
+void PN532Capture::decode(Print &out)
+{
+  uint32_t last = 0;
+
+  for (uint16_t pos = 0; pos < _length; pos += PN532_CAPTURE_HEADER + byteAt(pos+5))
+  {
+    uint8_t type = byteAt(pos);
+    uint8_t len = byteAt(pos+5);
+    uint32_t stamp = 0;
+    for (uint8_t i = 0; i < 4; i++)
+      stamp |= (uint32_t)byteAt(pos+1+i) << (8*i);
+
+    out.print('+');
+    out.print(pos ? stamp - last : 0UL);
+    out.print(F("us "));
+    last = stamp;
+
+    if (type == PN532_TRACE_TX)
+      out.print(F("TX"));
+    else if (type == PN532_TRACE_ACK)
+      out.print(F("ACK"));
+    else if (type == PN532_TRACE_RX)
+      out.print(F("RX"));
+    else
+      out.print(F("ERR"));
+
+    if ((type == PN532_TRACE_TX) || (type == PN532_TRACE_RX))
     {
-       if(!readPassiveTargetID(PN532_MIFARE_ISO14443A, _uid, &uidLength)) //try to find one
-           return -2;
+      // look the command up, responses carry its code + 1
+      uint8_t command = byteAt(pos+6) - ((type == PN532_TRACE_RX) ? 1 : 0);
+      PGM_P name = commandNameTable;
+      while (pgm_read_byte(name) && (pgm_read_byte(name) != command))
+        name += strlen_P(name) + 1;
+      if (pgm_read_byte(name))
+      {
+        out.print(' ');
+        for (name++; pgm_read_byte(name); name++)
+          out.print((char)pgm_read_byte(name));
+      }
     }
-    uint8_t numBlockStart = DataBlockAddr[byteAddrStart/16];
-    uint8_t numByteStart = byteAddrStart%16;
-    uint8_t numBlockEnd = DataBlockAddr[byteAddrEnd/16];
-    uint8_t numByteEnd = byteAddrEnd%16;
-    uint8_t completeBlockCount = 0;
-    
-    for(uint8_t numBlock=numBlockStart;numBlock<=numBlockEnd;numBlock++)
+
+    for (uint8_t i = 0; i < len; i++)
     {
-        if(numBlock == numBlockStart)
-        {
-            if(!mifareclassic_AuthenticateBlock (_uid, uidLength, numBlockStart, 1, keyuniversal)) //authen the block
-            {
-                fS50found =0; //if failed to authenticate try to research a mifare card.
-                return -3;
-            }
-            if(!mifareclassic_ReadDataBlock(numBlockStart, data)) //read block
-                return -4;
-            memcpy(buff,data+numByteStart,16-numByteStart);
-        }
-        else if (numBlock == numBlockEnd)
-        {
-            if(!mifareclassic_AuthenticateBlock (_uid, uidLength, numBlockEnd, 1, keyuniversal)) //authen the block
-            {
-                fS50found =0; //if failed to authenticate try to research a mifare card.
-                return -3;
-            }
-            if(!mifareclassic_ReadDataBlock(numBlockEnd, data)) //read block
-                return -4;
-            memcpy(buff+length-numByteEnd-1,data,numByteEnd+1);
-        } 
-        else if(isDataBlock[numBlock])
-        {
-            if(!mifareclassic_AuthenticateBlock (_uid, uidLength, numBlock, 1, keyuniversal)) //authen the block
-            {
-                fS50found =0; //if failed to authenticate try to research a mifare card.
-                return -3;
-            }
-            if(!mifareclassic_ReadDataBlock(numBlock, data)) //read block
-                return -4;
-            memcpy(buff+completeBlockCount*16+16-numBlockStart+1,data,16);
-            completeBlockCount++;
-        }
+      out.print(' ');
+      if (byteAt(pos+6+i) <= 0xF)
+        out.print('0');
+      out.print(byteAt(pos+6+i), HEX);
     }
-    return 1;
-
+    out.println();
+  }
 }
 
 
+
+/***** Capture Replay ******/
+
+PN532ReplayStream::PN532ReplayStream(PN532Capture *capture, boolean timing)
+{
+  _capture = capture;
+  _timing = timing;
+  rewind();
+}
+
 /**************************************************************************/
 /*! 
-    @brief  write bytes to card according to the address, the address should be with the rage
-            of 0 - 752, from Bytes 0 of block 1 to Byte 16 of block 62 
-
-    @param  byteAddr    the address of the data to read. 16*47 data bytes  
-    
-    @returns   -1   if address is without the range
-               -2   if failed to find a Mifare Classic card card
-               -3   if authentication failed
-               -4   if failed to read the block
-               -5   if failed to write the block
-               1    if succeed
+    @brief  Starts the replay over, at the first captured command
 */
 /**************************************************************************/
-int DFRNFC::write(unsigned int byteAddr,uint8_t byteData)
+void PN532ReplayStream::rewind(void)
 {
-    if(byteAddr> 751)
-        return -1;  // without the range
-    if(!fS50found)  // if no s50 card has been find
-    {
-       if(!readPassiveTargetID(PN532_MIFARE_ISO14443A, _uid, &uidLength)) //try to find one
-           return -2;
-    }
-    uint8_t numBlock = DataBlockAddr[byteAddr/16];
-    uint8_t numByte = byteAddr%16;
-/*     if(numBlock > 1)
-    {
-        uint8_t numSector = (numBlock - 2)/3 + 1;
-        numBlock = numSector*4 + (numBlock - 2)%3;
-    }
-    else numBlock++; */
-    if(!mifareclassic_AuthenticateBlock (_uid, uidLength, numBlock, 1, keyuniversal))  //authen the block
-    {   
-        fS50found = 0;
-        return -3;
-    }
-    if(!mifareclassic_ReadDataBlock(numBlock, data)) //read block
-        return -4;
-    data[numByte] = byteData;                        //write the data
-    if(!mifareclassic_WriteDataBlock(numBlock,data)) //write the block
-        return -5;
-    return 1;
+  _pos = 0;
+  while ((_pos < _capture->length()) && (_capture->byteAt(_pos) != PN532_TRACE_TX))
+    _pos += PN532_CAPTURE_HEADER + _capture->byteAt(_pos+5);
+  _txMicros = 0;
+  _txDone = micros();
+  _out = 0;
+  _hostState = 0;
+  _frames = 0;
+  _mismatches = 0;
 }
 
-
 /**************************************************************************/
 /*! 
-    @brief  write string  to data block, the end address should be with the rage
-            of 0 - 752, from Bytes 0 of block 1 to Byte 16 of block 62 
+    @brief  Selects the ACK or response to play next
 
-    @param  byteAddr    the address of the data to read. 16*47 data bytes  
-    
-    @returns   -1   if address is without the range
-               -2   if failed to find a Mifare Classic card card
-               -3   if authentication failed
-               -4   if failed to read block
-               data if succeed
+    @returns  1 if there is one, 0 if the next record is a command
+              (or the capture is over)
 */
 /**************************************************************************/
-int DFRNFC::writeBytes(uint8_t* buff, unsigned int byteAddrStart, unsigned int length)
-{  
-    int byteAddrEnd = byteAddrStart +length -1; 
-    if(byteAddrEnd > 751)
-       return -1;   // without range
-    if(!fS50found)  // if no s50 card has been find
+boolean PN532ReplayStream::nextoutput(void)
+{
+  if (_out)
+    return 1;
+
+  while (_pos < _capture->length())
+  {
+    uint8_t type = _capture->byteAt(_pos);
+    uint8_t len = _capture->byteAt(_pos+5);
+    if (type == PN532_TRACE_TX)
+      return 0;
+    if (type == PN532_TRACE_ERROR)
     {
-       if(!readPassiveTargetID(PN532_MIFARE_ISO14443A, _uid, &uidLength)) //try to find one
-           return -2;
+      _pos += PN532_CAPTURE_HEADER + len;   // nothing on the wire
+      continue;
     }
-    uint8_t numBlockStart = DataBlockAddr[byteAddrStart/16];
-    uint8_t numByteStart = byteAddrStart%16;
-    uint8_t numBlockEnd = DataBlockAddr[byteAddrEnd/16];
-    uint8_t numByteEnd = byteAddrEnd%16;
-    uint8_t completeBlockCount = 0;
-    
-    for(uint8_t numBlock=numBlockStart;numBlock<=numBlockEnd;numBlock++)
+
+    uint32_t stamp = 0;
+    for (uint8_t i = 0; i < 4; i++)
+      stamp |= (uint32_t)_capture->byteAt(_pos+1+i) << (8*i);
+    _outDue = _txDone + (stamp - _txMicros);
+    _outIndex = 0;
+    if (type == PN532_TRACE_ACK)
     {
-        if(numBlock == numBlockStart)
-        {
-            if(!mifareclassic_AuthenticateBlock (_uid, uidLength, numBlockStart, 1, keyuniversal)) //authen the block
-            {
-                fS50found =0; //if failed to authenticate try to research a mifare card.
-                return -3;
-            }
-            if(!mifareclassic_ReadDataBlock(numBlockStart, data)) //read block
-                return -4;
-            memcpy(data+numByteStart,buff,16-numByteStart);
-            if(!mifareclassic_WriteDataBlock(numBlock,data)) //write the block
-                return -5;
-        }
-        else if (numBlock == numBlockEnd)
-        {
-            if(!mifareclassic_AuthenticateBlock (_uid, uidLength, numBlockEnd, 1, keyuniversal)) //authen the block
-            {
-                fS50found =0; //if failed to authenticate try to research a mifare card.
-                return -3;
-            }
-            if(!mifareclassic_ReadDataBlock(numBlockEnd, data)) //read block
-                return -4;
-            memcpy(data,buff+length-numByteEnd-1,numByteEnd+1);
-            if(!mifareclassic_WriteDataBlock(numBlockEnd,data)) //write the block
-                return -5;
-        } 
-        else if(isDataBlock[numBlock])
-        {
-            if(!mifareclassic_AuthenticateBlock (_uid, uidLength, numBlock, 1, keyuniversal)) //authen the block
-            {
-                fS50found =0; //if failed to authenticate try to research a mifare card.
-                return -3;
-            }
-            if(!mifareclassic_ReadDataBlock(numBlock, data)) //read block
-                return -4;
-            memcpy(data,buff+completeBlockCount*16+16-numBlockStart+1,16);
-            completeBlockCount++;
-            if(!mifareclassic_WriteDataBlock(numBlock,data)) //write the block
-                return -5;
-        }
+      _out = 6;
+      return 1;
     }
-    return 1;
 
+    _out = len + 8;   // 00 00 FF LEN LCS D5 data DCS 00
+    _outSum = PN532_PN532TOHOST;
+    for (uint8_t i = 0; i < len; i++)
+      _outSum += _capture->byteAt(_pos+6+i);
+    return 1;
+  }
+  return 0;
 }
 
 /**************************************************************************/
 /*! 
-    @brief  try to find the PN532& Mifare Classic card
-
-    @returns   -1   if failed to find pn532
-               -2   if failed to find a Mifare Classic card
-               1    if succeed
+    @brief  The wire byte of the current record at _outIndex
 */
 /**************************************************************************/
-int DFRNFC::availinfo()
+uint8_t PN532ReplayStream::outbyte(void)
 {
-    uint8_t version[4];
-    SAMConfig();
-    if(!getFirmwareVersion(version))
-    {
-        _serial->println("version failed");
-        return -1;
-    }
-    
-    if(!readPassiveTargetID(PN532_MIFARE_ISO14443A, _uid, &uidLength))
-    {
-        _serial->println("card failed");
-        return -2;
-    }    
-      // Got ok data, print it out!
-    _serial->print("Found chip PN5"); _serial->println(version[0],HEX);
-    _serial->print("Firmware ver."); _serial->print(version[1],DEC);
-    _serial->print('.'); _serial->println(version[2], DEC);
-    return 1;
+  if (_out == 6)
+    return pgm_read_byte(pn532ack + _outIndex);
+
+  uint8_t len = _out - 8;
+  if (_outIndex < 3)
+    return (_outIndex < 2) ? PN532_PREAMBLE : PN532_STARTCODE2;
+  if (_outIndex == 3)
+    return len + 1;
+  if (_outIndex == 4)
+    return ~(len + 1) + 1;
+  if (_outIndex == 5)
+    return PN532_PN532TOHOST;
+  if (_outIndex < 6 + len)
+    return _capture->byteAt(_pos + 6 + _outIndex - 6);
+  if (_outIndex == 6 + len)
+    return ~_outSum + 1;
+  return PN532_POSTAMBLE;
 }
 
-/**************************************************************************/
-/*! 
-    @brief  try to find the PN532& Mifare Classic card
+int PN532ReplayStream::available(void)
+{
+  if (!nextoutput())
+    return 0;
+  if (_timing && ((int32_t)(micros() - _outDue) < 0))
+    return 0;
+  return _out - _outIndex;
+}
 
-    @returns   -1   if failed to find pn532
-               -2   if failed to find a Mifare Classic card
-               1    if succeed
-*/
-/**************************************************************************/
-int DFRNFC::available()
+int PN532ReplayStream::peek(void)
 {
-    uint8_t version[4];
-    SAMConfig();
-    if(!getFirmwareVersion(version))
-        return -1;    
-    if(!readPassiveTargetID(PN532_MIFARE_ISO14443A, _uid, &uidLength))
-        return -2;  
-    return 1;
+  if (available() <= 0)
+    return -1;
+  return outbyte();
 }
 
+int PN532ReplayStream::read(void)
+{
+  if (available() <= 0)
+    return -1;
+
+  uint8_t b = outbyte();
+  if (++_outIndex == _out)
+  {
+    _pos += PN532_CAPTURE_HEADER + _capture->byteAt(_pos+5);
+    _out = 0;
+  }
+  return b;
+}
 
 /**************************************************************************/
 /*! 
-    @brief  try to dump the Mifare Classic card mem
+    @brief  Takes a byte written by DFRNFC and matches complete command
+            frames against the capture. Wake-up bytes and ACKs sent by
+            the host are skipped
 */
 /**************************************************************************/
-void DFRNFC::memdump(void)
+size_t PN532ReplayStream::write(uint8_t b)
 {
-    _serial->println("Start memdump");
-    for(int i=0;i<64;i++)
-    {
-      if(!mifareclassic_AuthenticateBlock (_uid, uidLength, i, 1, keyuniversal))
+  switch (_hostState)
+  {
+    case 0:   // 00
+    case 1:   // 00
+      _hostState = (b == PN532_PREAMBLE) ? _hostState + 1 : 0;
+      break;
+    case 2:   // FF, more zeros may come first
+      if (b == PN532_STARTCODE2)
+        _hostState = 3;
+      else if (b != PN532_PREAMBLE)
+        _hostState = 0;
+      break;
+    case 3:   // LEN
+      _hostLength = b;
+      _hostState = 4;
+      break;
+    case 4:   // LCS
+      _hostState = ((uint8_t)(_hostLength + b) == 0 && _hostLength > 1) ? 5 : 0;
+      break;
+    case 5:   // TFI, a command frame starts
+      if (b != PN532_HOSTTOPN532)
       {
-        _serial->print("Block ");_serial->print(i,DEC);_serial->print(":  ");
-        _serial->println("failed to authen");
+        _hostState = 0;
+        break;
       }
-      else
+      // anything the library left unread was not played as captured
+      while ((_pos < _capture->length()) && (_capture->byteAt(_pos) != PN532_TRACE_TX))
       {
-        if(!mifareclassic_ReadDataBlock(i,data))
-        {
-          _serial->print("Block ");_serial->print(i,DEC);_serial->print(":  ");
-          _serial->println("failed to read");
-        }
-        else
-        {
-          _serial->print("Block "); _serial->print(i,DEC);_serial->print(":  ");
-          PrintHexChar(data,16);
-        }
+        if (_capture->byteAt(_pos) != PN532_TRACE_ERROR)
+          _mismatches++;
+        _pos += PN532_CAPTURE_HEADER + _capture->byteAt(_pos+5);
       }
-    }
-}
-
-/**************************************************************************/
-/*! 
-    @brief  Prints a hexadecimal value in plain characters
-
-    @param  data      Pointer to the byte data
-    @param  numBytes  Data length in bytes
-*/
-/**************************************************************************/
-void DFRNFC::PrintHex(const byte * data, const uint32_t numBytes)
-{
-  uint32_t szPos;
-  for (szPos=0; szPos < numBytes; szPos++) 
-  {
-    _serial->print("0x");
-    // Append leading 0 for small values
-    if (data[szPos] <= 0xF)
-      _serial->print("0");
-    _serial->print(data[szPos], HEX);
-    if ((numBytes > 1) && (szPos != numBytes - 1))
-    {
-      _serial->print(" ");
-    }
+      _out = 0;
+      _hostIndex = 0;
+      _hostMatch = (_pos < _capture->length()) && (_capture->byteAt(_pos+5) == _hostLength - 1);
+      _hostState = 6;
+      break;
+    case 6:   // command code and parameters
+      if (_hostMatch && (_capture->byteAt(_pos + 6 + _hostIndex) != b))
+        _hostMatch = 0;
+      if (++_hostIndex == _hostLength - 1)
+        _hostState = 7;
+      break;
+    case 7:   // DCS
+      hostframe();
+      _hostState = 0;
+      break;
   }
-  _serial->println("");
+  return 1;
 }
 
-
-
 /**************************************************************************/
 /*! 
-    @brief  Prints a hexadecimal value in plain characters, along with
-            the char equivalents in the following format
-
-            00 00 00 00 00 00  ......
-
-    @param  data      Pointer to the byte data
-    @param  numBytes  Data length in bytes
+    @brief  A complete command arrived, the next response becomes due
 */
 /**************************************************************************/
-void DFRNFC::PrintHexChar(const byte * data, const uint32_t numBytes)
+void PN532ReplayStream::hostframe(void)
 {
-  uint32_t szPos;
-  for (szPos=0; szPos < numBytes; szPos++) 
-  {
-    // Append leading 0 for small values
-    if (data[szPos] <= 0xF)
-      _serial->print("0");
-    _serial->print(data[szPos], HEX);
-    if ((numBytes > 1) && (szPos != numBytes - 1))
-    {
-      _serial->print(" ");
-    }
-  }
-  _serial->print("  ");
-  for (szPos=0; szPos < numBytes; szPos++) 
+  _frames++;
+  if (!_hostMatch)
+    _mismatches++;
+
+  if (_pos < _capture->length())
   {
-    if (data[szPos] <= 0x1F)
-      _serial->print(".");
-    else
-      _serial->print(data[szPos]);
+    _txMicros = 0;
+    for (uint8_t i = 0; i < 4; i++)
+      _txMicros |= (uint32_t)_capture->byteAt(_pos+1+i) << (8*i);
+    _pos += PN532_CAPTURE_HEADER + _capture->byteAt(_pos+5);
   }
-  _serial->println("");
+  _txDone = micros();
 }
- 
\ No newline at end of file
@@ -16,6 +16,7 @@
 #define PN532_POSTAMBLE                     (0x00)
 
 #define PN532_HOSTTOPN532                   (0xD4)
+#define PN532_PN532TOHOST                   (0xD5)
 
 // PN532 Commands
 #define PN532_COMMAND_DIAGNOSE              (0x00)
@@ -57,6 +58,112 @@
 #define PN532_WAKEUP                        (0x55)
 
 #define PN532_MIFARE_ISO14443A              (0x00)
+#define PN532_FELICA_212                    (0x01)
+#define PN532_FELICA_424                    (0x02)
+#define PN532_ISO14443B                     (0x03)
+
+// FeliCa Commands
+#define FELICA_CMD_POLLING                  (0x00)
+#define FELICA_CMD_READ_WITHOUT_ENCRYPTION  (0x06)
+// 14 blocks keep the answer within a normal frame (LEN <= 255)
+#define FELICA_READ_MAXBLOCKS               (14)
+
+// RFConfiguration items
+#define PN532_RFCFG_FIELD                   (0x01)
+#define PN532_RFCFG_TIMINGS                 (0x02)
+#define PN532_RFCFG_MAXRETRYCOM             (0x04)
+#define PN532_RFCFG_MAXRETRIES              (0x05)
+#define PN532_RFCFG_ANALOG_106A             (0x0A)
+#define PN532_RFCFG_ANALOG_212_424          (0x0B)
+#define PN532_RFCFG_ANALOG_TYPEB            (0x0C)
+#define PN532_RFCFG_ANALOG_ISO14443_4       (0x0D)
+
+// RFConfiguration timeout codes (ATR_RES_TIMEOUT, RETRY_TIMEOUT)
+#define PN532_RFTIMEOUT_NONE                (0x00)
+#define PN532_RFTIMEOUT_100US               (0x01)
+#define PN532_RFTIMEOUT_200US               (0x02)
+#define PN532_RFTIMEOUT_400US               (0x03)
+#define PN532_RFTIMEOUT_800US               (0x04)
+#define PN532_RFTIMEOUT_1600US              (0x05)
+#define PN532_RFTIMEOUT_3200US              (0x06)
+#define PN532_RFTIMEOUT_6400US              (0x07)
+#define PN532_RFTIMEOUT_12800US             (0x08)
+#define PN532_RFTIMEOUT_25600US             (0x09)
+#define PN532_RFTIMEOUT_51200US             (0x0A)
+#define PN532_RFTIMEOUT_102400US            (0x0B)
+#define PN532_RFTIMEOUT_204800US            (0x0C)
+#define PN532_RFTIMEOUT_409600US            (0x0D)
+#define PN532_RFTIMEOUT_819200US            (0x0E)
+#define PN532_RFTIMEOUT_1640MS              (0x0F)
+#define PN532_RFTIMEOUT_3280MS              (0x10)
+
+// PN532 registers for ReadRegister/WriteRegister (CIU block in XRAM, SFRs)
+#define PN532_REG_CIU_MODE                  (0x6301)
+#define PN532_REG_CIU_TXMODE                (0x6302)
+#define PN532_REG_CIU_RXMODE                (0x6303)
+#define PN532_REG_CIU_TXCONTROL             (0x6304)
+#define PN532_REG_CIU_TXAUTO                (0x6305)
+#define PN532_REG_CIU_TXSEL                 (0x6306)
+#define PN532_REG_CIU_RXSEL                 (0x6307)
+#define PN532_REG_CIU_RXTHRESHOLD           (0x6308)
+#define PN532_REG_CIU_DEMOD                 (0x6309)
+#define PN532_REG_CIU_FELNFC1               (0x630A)
+#define PN532_REG_CIU_FELNFC2               (0x630B)
+#define PN532_REG_CIU_MIFNFC                (0x630C)
+#define PN532_REG_CIU_MANUALRCV             (0x630D)
+#define PN532_REG_CIU_TYPEB                 (0x630E)
+#define PN532_REG_CIU_CRCRESULT_MSB         (0x6311)
+#define PN532_REG_CIU_CRCRESULT_LSB         (0x6312)
+#define PN532_REG_CIU_GSNOFF                (0x6313)
+#define PN532_REG_CIU_MODWIDTH              (0x6314)
+#define PN532_REG_CIU_TXBITPHASE            (0x6315)
+#define PN532_REG_CIU_RFCFG                 (0x6316)
+#define PN532_REG_CIU_GSNON                 (0x6317)
+#define PN532_REG_CIU_CWGSP                 (0x6318)
+#define PN532_REG_CIU_MODGSP                (0x6319)
+#define PN532_REG_CIU_TMODE                 (0x631A)
+#define PN532_REG_CIU_TPRESCALER            (0x631B)
+#define PN532_REG_CIU_TRELOAD_HI            (0x631C)
+#define PN532_REG_CIU_TRELOAD_LO            (0x631D)
+#define PN532_REG_CIU_TCOUNTERVAL_HI        (0x631E)
+#define PN532_REG_CIU_TCOUNTERVAL_LO        (0x631F)
+#define PN532_REG_CIU_VERSION               (0x6327)
+#define PN532_REG_CIU_RFLEVELDET            (0x632F)
+#define PN532_REG_CIU_COMMAND               (0x6331)
+#define PN532_REG_CIU_COMMIEN               (0x6332)
+#define PN532_REG_CIU_DIVIEN                (0x6333)
+#define PN532_REG_CIU_COMMIRQ               (0x6334)
+#define PN532_REG_CIU_DIVIRQ                (0x6335)
+#define PN532_REG_CIU_ERROR                 (0x6336)
+#define PN532_REG_CIU_STATUS1               (0x6337)
+#define PN532_REG_CIU_STATUS2               (0x6338)
+#define PN532_REG_CIU_FIFODATA              (0x6339)
+#define PN532_REG_CIU_FIFOLEVEL             (0x633A)
+#define PN532_REG_CIU_WATERLEVEL            (0x633B)
+#define PN532_REG_CIU_CONTROL               (0x633C)
+#define PN532_REG_CIU_BITFRAMING            (0x633D)
+#define PN532_REG_CIU_COLL                  (0x633E)
+#define PN532_REG_SFR_P3                    (0xFFB0)
+#define PN532_REG_SFR_P7                    (0xFFF7)
+
+// PowerDown wake-up sources
+#define PN532_WAKEUP_INT0                   (0x01)
+#define PN532_WAKEUP_INT1                   (0x02)
+#define PN532_WAKEUP_RF                     (0x08)
+#define PN532_WAKEUP_HSU                    (0x10)
+#define PN532_WAKEUP_SPI                    (0x20)
+#define PN532_WAKEUP_GPIO                   (0x40)
+#define PN532_WAKEUP_I2C                    (0x80)
+
+// NFC-DEP bit rates (InJumpForDEP BR, InPSL BRit/BRti)
+#define PN532_BAUDRATE_106K                 (0x00)
+#define PN532_BAUDRATE_212K                 (0x01)
+#define PN532_BAUDRATE_424K                 (0x02)
+
+// InDataExchange: Tg/Status "more information" flag and the largest data
+// field that fits a normal information frame next to TFI, command and Tg
+#define PN532_MI                            (0x40)
+#define PN532_INDATAEXCHANGE_MAXLEN         (252)
 
 // Mifare Commands
 #define MIFARE_CMD_AUTH_A                   (0x60)
@@ -69,6 +176,19 @@
 #define MIFARE_CMD_INCREMENT                (0xC1)
 #define MIFARE_CMD_STORE                    (0xC2)
 
+// NTAG21x Commands
+#define NTAG_CMD_GET_VERSION                (0x60)
+#define NTAG_CMD_FAST_READ                  (0x3A)
+#define NTAG_CMD_READ_CNT                   (0x39)
+#define NTAG_CMD_PWD_AUTH                   (0x1B)
+
+// SEL_RES bits and the data areas of read, readBytes, readStream, ...
+#define PN532_SAK_MIFARE_CLASSIC            (0x08)
+#define PN532_SAK_MIFARE_4K                 (0x10)
+#define PN532_MIFARE_1K_DATA                (752)   // data blocks 1 - 62
+#define PN532_MIFARE_4K_DATA                (3440)  // adds the data blocks of sectors 16 - 39
+#define PN532_TYPE2_MAX_DATA                (1008)  // pages 4 - 255
+
 // Prefixes for NDEF Records (to identify record type)
 #define NDEF_URIPREFIX_NONE                 (0x00)
 #define NDEF_URIPREFIX_HTTP_WWWDOT          (0x01)
@@ -107,6 +227,426 @@
 #define NDEF_URIPREFIX_URN_EPC              (0x22)
 #define NDEF_URIPREFIX_URN_NFC              (0x23)
 
+// TLV blocks wrapping the NDEF message (Type 2 Tag and Mifare Classic mapping)
+#define NDEF_TLV_NULL                       (0x00)
+#define NDEF_TLV_LOCKCONTROL                (0x01)
+#define NDEF_TLV_MEMORYCONTROL              (0x02)
+#define NDEF_TLV_MESSAGE                    (0x03)
+#define NDEF_TLV_PROPRIETARY                (0xFD)
+#define NDEF_TLV_TERMINATOR                 (0xFE)
+
+// NDEF record header flags
+#define NDEF_RECORD_MB                      (0x80)
+#define NDEF_RECORD_ME                      (0x40)
+#define NDEF_RECORD_CF                      (0x20)
+#define NDEF_RECORD_SR                      (0x10)
+#define NDEF_RECORD_IL                      (0x08)
+#define NDEF_RECORD_TNF_MASK                (0x07)
+
+// NDEF Type Name Format
+#define NDEF_TNF_EMPTY                      (0x00)
+#define NDEF_TNF_WELL_KNOWN                 (0x01)
+#define NDEF_TNF_MIME_MEDIA                 (0x02)
+#define NDEF_TNF_ABSOLUTE_URI               (0x03)
+#define NDEF_TNF_EXTERNAL                   (0x04)
+#define NDEF_TNF_UNKNOWN                    (0x05)
+#define NDEF_TNF_UNCHANGED                  (0x06)
+
+// NDEFParser::feed results
+#define NDEF_PARSE_MORE                     (0)
+#define NDEF_PARSE_DONE                     (1)
+#define NDEF_PARSE_OVERFLOW                 (-1)
+
+// Error codes, see DFRNFC::lastError
+#define PN532_ERROR_NONE                    (0x00)
+#define PN532_ERROR_TIMEOUT                 (0x01)  // no or incomplete answer
+#define PN532_ERROR_NACK                    (0x02)  // the PN532 rejected the frame
+#define PN532_ERROR_FRAME                   (0x03)  // malformed or unexpected frame
+#define PN532_ERROR_CHECKSUM                (0x04)  // LCS or DCS mismatch
+#define PN532_ERROR_STATUS                  (0x05)  // error status, see DFRNFC::lastStatus
+#define PN532_ERROR_AUTH                    (0x06)  // Mifare authentication failed
+#define PN532_ERROR_OVERFLOW                (0x07)  // response larger than the buffer
+#define PN532_ERROR_NOCARD                  (0x08)  // no target in the field
+#define PN532_ERROR_RANGE                   (0x09)  // parameter out of range
+
+// Uncomment to collect command counters and a latency histogram,
+// see DFRNFC::stats. Costs sizeof(PN532Stats) bytes of RAM per
+// instance, nothing without it.
+// #define PN532STATS
+#define PN532_LATENCY_BUCKETS               (8)
+
+// Uncomment to pass every frame, ACK and error to a trace hook, see
+// DFRNFC::setTraceHook. Without it the hooks compile to nothing.
+// #define PN532TRACE
+
+// PN532TraceEvent types
+#define PN532_TRACE_TX                      (0x01)  // command sent
+#define PN532_TRACE_ACK                     (0x02)  // command acknowledged
+#define PN532_TRACE_RX                      (0x03)  // response received
+#define PN532_TRACE_ERROR                   (0x04)  // see PN532TraceEvent::error
+#define PN532_TRACE_DATA                    (8)     // bytes kept per PN532TraceEntry
+#define PN532_CAPTURE_HEADER                (6)     // type, micros, length
+
+// Default serial timeout for ACKs and responses, in ms
+#define PN532_TIMEOUT                       (1000)
+
+// Frames are assembled in a buffer of this size and written in one go,
+// longer frames in several pieces
+#define PN532_FRAMEBUFFSIZ                  (32)
+
+// Recovery tiers of the retry policy, see PN532RetryStats
+#define PN532_TIER_REAUTH                   (0)     // authenticate again
+#define PN532_TIER_RESELECT                 (1)     // InSelect, then authenticate
+#define PN532_TIER_RELIST                   (2)     // InListPassiveTarget, then authenticate
+#define PN532_TIERS                         (3)
+
+// DFRNFC::checkSession results
+#define PN532_SESSION_NONE                  (0)     // no card in the field
+#define PN532_SESSION_SAME                  (1)     // the card of the current session
+#define PN532_SESSION_NEW                   (2)     // another card, or a card after the session ended
+
+// Idle time after which read/write check that the card is still there, in ms
+#define PN532_SESSION_TIMEOUT               (500)
+
+
+/*
+ * CIU register values the PN532 loads for 106 kbps type A
+ * (RFConfiguration item 0x0A), in command order.
+ */
+struct PN532AnalogTypeA
+{
+    uint8_t rfCfg;          // CIU_RFCfg: receiver gain and RF level detector
+    uint8_t gsNOn;          // CIU_GsNOn: conductance when the field is on
+    uint8_t cwGsP;          // CIU_CWGsP: conductance of the P-driver
+    uint8_t modGsP;         // CIU_ModGsP: modulation conductance
+    uint8_t demodOwnRFOn;   // CIU_Demod with own RF field on
+    uint8_t rxThreshold;    // CIU_RxThreshold
+    uint8_t demodOwnRFOff;  // CIU_Demod with own RF field off
+    uint8_t gsNOff;         // CIU_GsNOff
+    uint8_t modWidth;       // CIU_ModWidth
+    uint8_t mifare;         // CIU_MifNFC
+    uint8_t txBitPhase;     // CIU_TxBitPhase
+};
+
+/*
+ * Power management counters, see DFRNFC::powerStats
+ */
+struct PN532PowerStats
+{
+    uint32_t sleeps;          // successful PowerDown commands
+    uint32_t wakes;           // transparent wake-ups
+    uint32_t reinits;         // wake-ups that needed a full SAMConfig
+    uint32_t lastWakeMicros;  // wake-up until the first ACK
+    uint32_t maxWakeMicros;
+    uint32_t asleepMillis;    // total time spent in PowerDown
+};
+
+/*
+ * Command counters, see DFRNFC::stats. latency[i] counts the commands
+ * that took less than 2^i ms (i = 0: below 1 ms), the last bucket
+ * everything slower. The frame times are the cost of receiving and
+ * decoding a response once it started to arrive.
+ */
+struct PN532Stats
+{
+    uint32_t commands;        // commands sent
+    uint32_t timeouts;        // missing ACK or response
+    uint32_t frameErrors;     // NACK, checksum or malformed frames
+    uint32_t statusErrors;    // error status from the PN532 or the card
+    uint32_t authFailures;    // Mifare authentication errors (status 0x14)
+    uint32_t retries;         // re-initialisations and re-polls
+    uint32_t latency[PN532_LATENCY_BUCKETS];
+    uint32_t lastLatencyMicros;
+    uint32_t maxLatencyMicros;
+    uint32_t frames;          // response frames received intact
+    uint32_t frameMicros;     // recent average from the frame header to the checked frame
+    uint32_t maxFrameMicros;
+};
+
+/*
+ * RAM of the library in the build at hand, see DFRNFC::ramUsage.
+ * frame, stats and trace are parts of instance, listed to show what
+ * the switches cost; stats and trace are 0 when switched off.
+ */
+struct PN532RamUsage
+{
+    uint16_t instance;        // one DFRNFC
+    uint16_t packetBuffer;    // shared by all instances
+    uint16_t frame;           // outgoing frame buffer
+    uint16_t stats;           // PN532STATS counters
+    uint16_t trace;           // PN532TRACE hook
+    uint16_t capture;         // one PN532Capture, without the buffer the sketch hands in
+};
+
+/*
+ * How read, write, readBytes and writeBytes recover from a failed
+ * block access, see DFRNFC::setRetryPolicy. The tiers are tried in
+ * order, each the given number of times. Re-authentication is skipped
+ * when the card rejected the key, it is halted then and has to be
+ * selected again.
+ */
+struct PN532RetryPolicy
+{
+    uint8_t reauth;           // attempts that only authenticate again
+    uint8_t reselect;         // attempts after InSelect
+    uint8_t relist;           // attempts after InListPassiveTarget
+    uint8_t latencyFactor;    // timeout = factor * average latency, 0 keeps PN532_TIMEOUT
+    uint16_t minTimeout;      // ms, bounds for the adaptive timeout
+    uint16_t maxTimeout;
+};
+
+/*
+ * Retry counters, see DFRNFC::retryStats
+ */
+struct PN532RetryStats
+{
+    uint32_t failures;                // block accesses that failed at first
+    uint32_t recovered[PN532_TIERS];  // by the tier that recovered them
+    uint32_t unrecovered;
+};
+
+/*
+ * Blocks the scan pipeline reads from every card, see DFRNFC::setScan.
+ * The range is authenticated once per sector with the given key.
+ */
+struct PN532ScanRange
+{
+    uint8_t block;            // first block, 0..255
+    uint8_t blocks;           // number of blocks
+    uint8_t keyNumber;        // 0 = key A, 1 = key B
+    const uint8_t *key;       // 6 bytes
+};
+
+/*
+ * Receives the data of readStream piece by piece, or fills it in for
+ * writeStream. byteAddr is the data address of data[0], at most one
+ * block (16 bytes) is passed at a time. Return 0 to stop the stream.
+ */
+typedef boolean (*PN532ChunkCallback)(unsigned int byteAddr, uint8_t *data, uint8_t len, void *context);
+
+typedef void (*PN532ScanCallback)(const uint8_t *uid, uint8_t uidLength, const uint8_t *data, uint16_t len, void *context);
+
+/*
+ * Scan pipeline counters, see DFRNFC::scanStats. millis is the time
+ * spent in scan without the callbacks.
+ */
+struct PN532ScanStats
+{
+    uint32_t polls;           // calls to scan
+    uint32_t taps;            // cards read and reported
+    uint32_t failures;        // cards that could not be read
+    uint32_t millis;
+};
+
+/*
+ * A trace event. For PN532_TRACE_TX data starts with the command code,
+ * for PN532_TRACE_RX with the first byte after the response code. The
+ * frame is split in data and body the same way the library buffers it,
+ * both pointers are only valid during the hook call.
+ */
+struct PN532TraceEvent
+{
+    uint8_t type;             // PN532_TRACE_*
+    uint8_t command;          // command code of the current exchange
+    uint8_t error;            // PN532_ERROR_* for PN532_TRACE_ERROR
+    uint32_t micros;          // micros() when the event happened
+    const uint8_t *data;
+    uint16_t len;
+    const uint8_t *body;
+    uint16_t bodylen;
+};
+
+typedef void (*PN532TraceHook)(const PN532TraceEvent *event, void *context);
+
+/*
+ * One event as kept by PN532TraceBuffer, with the first
+ * PN532_TRACE_DATA bytes of its frame.
+ */
+struct PN532TraceEntry
+{
+    uint8_t type;
+    uint8_t command;
+    uint8_t error;
+    uint8_t len;              // full frame length, may exceed the data kept
+    uint32_t micros;
+    uint8_t data[PN532_TRACE_DATA];
+};
+
+/*
+ * Ring buffer for trace events, install it with
+ * nfc.setTraceHook(PN532TraceBuffer::record, &traceBuffer).
+ * The oldest entries are overwritten when it is full.
+ */
+class PN532TraceBuffer
+{
+public:
+    PN532TraceBuffer(PN532TraceEntry *entries, uint8_t size);
+    static void record(const PN532TraceEvent *event, void *context);
+    void clear(void);
+    uint8_t count(void) { return _count; }
+    const PN532TraceEntry *entry(uint8_t index);   // 0 is the oldest
+    uint32_t dropped(void) { return _dropped; }    // entries overwritten
+private:
+    PN532TraceEntry *_entries;
+    uint8_t _size;
+    uint8_t _head;
+    uint8_t _count;
+    uint32_t _dropped;
+};
+
+/*
+ * Wire capture in a byte ring buffer, install it with
+ * nfc.setTraceHook(PN532Capture::record, &capture). Each record is the
+ * PN532_TRACE_* type, micros() as 4 bytes little endian, the data
+ * length and the data: command or response code and parameters for
+ * frames, nothing for ACKs, the PN532_ERROR_* code for errors. The
+ * oldest records are dropped when the buffer is full. A capture saved
+ * with dump() can be loaded again by passing its length as used.
+ */
+class PN532Capture
+{
+public:
+    PN532Capture(uint8_t *buf, uint16_t size, uint16_t used = 0);
+    static void record(const PN532TraceEvent *event, void *context);
+    void clear(void);
+    uint16_t length(void) { return _length; }
+    uint32_t dropped(void) { return _dropped; }    // records overwritten
+    uint8_t byteAt(uint16_t offset);               // 0 is the oldest byte
+    void dump(Print &out);
+    void decode(Print &out);
+private:
+    uint8_t *_buf;
+    uint16_t _size;
+    uint16_t _start;
+    uint16_t _length;
+    uint32_t _dropped;
+    void put(uint8_t b);
+};
+
+/*
+ * Stream that plays the PN532 side of a capture back to DFRNFC. The
+ * commands written by the library are matched against the captured
+ * ones, ACKs and responses follow with the captured delays unless
+ * timing is off.
+ */
+class PN532ReplayStream : public Stream
+{
+public:
+    PN532ReplayStream(PN532Capture *capture, boolean timing = 1);
+    void rewind(void);
+    boolean finished(void) { return _pos >= _capture->length(); }
+    uint16_t frames(void) { return _frames; }          // commands received
+    uint16_t mismatches(void) { return _mismatches; }  // commands not as captured
+
+    virtual int available(void);
+    virtual int read(void);
+    virtual int peek(void);
+    virtual void flush(void) {}
+    virtual size_t write(uint8_t b);
+    using Print::write;
+private:
+    PN532Capture *_capture;
+    boolean _timing;
+    uint16_t _pos;          // next record
+    uint32_t _txMicros;     // captured time of the last command
+    uint32_t _txDone;       // when the library finished sending it
+    uint16_t _out;          // wire bytes of the current record, 0 if none
+    uint16_t _outIndex;
+    uint8_t _outSum;
+    uint32_t _outDue;
+    uint8_t _hostState;     // frame parser for the library's commands
+    uint8_t _hostLength;
+    uint8_t _hostIndex;
+    boolean _hostMatch;
+    uint16_t _frames;
+    uint16_t _mismatches;
+    boolean nextoutput(void);
+    uint8_t outbyte(void);
+    void hostframe(void);
+};
+
+/*
+ * One record of an NDEF message. type, id and payload point into the
+ * message buffer of the parser that produced it, nothing is copied.
+ */
+struct NDEFRecord
+{
+    uint8_t header;         // MB/ME/CF/SR/IL flags and TNF
+    uint8_t typeLength;
+    uint8_t idLength;
+    uint32_t payloadLength;
+    const uint8_t *type;
+    const uint8_t *id;
+    const uint8_t *payload;
+};
+
+/*
+ * Incremental TLV parser. Feed it the card memory block by block as it
+ * is read, it collects the value of the first NDEF message TLV into the
+ * caller's buffer and reports NDEF_PARSE_DONE as soon as the message (or
+ * a terminator TLV) is complete, so the reader can stop there.
+ */
+class NDEFParser
+{
+public:
+    NDEFParser(uint8_t *buf, uint16_t size);
+    void reset(void);
+    int8_t feed(const uint8_t *data, uint8_t len);
+    boolean isDone(void) { return _state == NDEF_STATE_DONE; }
+
+    const uint8_t *message(void) { return _buf; }
+    uint16_t messageLength(void) { return _msgLength; }
+
+    boolean nextRecord(NDEFRecord *record);
+    static uint8_t decodeUriPrefix(uint8_t uriIdentifier, char *buffer, uint8_t size);
+    void rewind(void) { _recordPos = 0; }
+private:
+    enum { NDEF_STATE_TYPE, NDEF_STATE_LENGTH, NDEF_STATE_LENGTH_HI, NDEF_STATE_LENGTH_LO, NDEF_STATE_VALUE, NDEF_STATE_DONE };
+    uint8_t *_buf;
+    uint16_t _size;
+    uint8_t _state;
+    uint8_t _tlvType;
+    uint16_t _tlvLength;
+    uint16_t _tlvPos;
+    uint16_t _msgLength;
+    uint16_t _recordPos;
+    int8_t beginValue(void);
+};
+
+/*
+ * Builds an NDEF message in the caller's buffer, one record at a time.
+ * MB/ME/SR are maintained automatically. tlvByte() presents the message
+ * wrapped in its NDEF TLV and followed by a terminator TLV, which is the
+ * byte stream the tag writers put on the card.
+ */
+class NDEFMessage
+{
+public:
+    NDEFMessage(uint8_t *buf, uint16_t size);
+    void reset(void);
+
+    boolean addRecord(uint8_t tnf, const uint8_t *type, uint8_t typeLength, const uint8_t *payload, uint16_t payloadLength);
+    boolean addUriRecord(uint8_t uriIdentifier, const char *uri);
+    boolean addUriRecord(const char *uri);
+    boolean addTextRecord(const char *text, const char *language = "en");
+    boolean addMimeRecord(const char *mimeType, const uint8_t *payload, uint16_t payloadLength);
+
+    const uint8_t *message(void) { return _buf; }
+    uint16_t messageLength(void) { return _length; }
+
+    uint16_t tlvLength(void);
+    uint8_t tlvByte(uint16_t offset);
+
+    static uint8_t encodeUriPrefix(const char *uri, uint8_t *prefixLength);
+private:
+    uint8_t *_buf;
+    uint16_t _size;
+    uint16_t _length;
+    uint16_t _lastHeader;
+    boolean beginRecord(uint8_t tnf, const uint8_t *type, uint8_t typeLength, uint32_t payloadLength);
+};
+
+
 
 class DFRNFC
 {
@@ -115,9 +655,61 @@ public:
     void begin(Stream &theSerial);
 
     // Generic PN532 functions
-    boolean SAMConfig(void);
+    boolean SAMConfig(uint8_t timeout = 0x14, boolean useIRQ = 1);
     uint8_t getFirmwareVersion(uint8_t *version);
+    const uint8_t *firmwareInfo(void) { return _firmware; }  // IC, Ver, Rev, Support as of the last init
     boolean setPassiveActivationRetries(uint8_t maxRetries);
+
+    // Power management
+    boolean powerDown(uint8_t wakeSources = PN532_WAKEUP_HSU);
+    boolean isAsleep(void) { return _asleep; }
+    void powerStats(PN532PowerStats *stats) { *stats = _powerStats; }
+    void resetPowerStats(void);
+
+    // Diagnostics
+    uint8_t lastError(void) { return _lastError; }    // PN532_ERROR_* of the last command
+    uint8_t lastStatus(void) { return _lastStatus; }  // last status byte, bits 0..5
+    void stats(PN532Stats *stats);
+    void resetStats(void);
+    void setTraceHook(PN532TraceHook hook, void *context = 0);
+    static uint16_t ramUsage(void);
+    static void ramUsage(PN532RamUsage *usage);
+
+    // Recovery of read, write, readBytes and writeBytes
+    void setRetryPolicy(const PN532RetryPolicy *policy) { _retryPolicy = *policy; }
+    void retryStats(PN532RetryStats *stats) { *stats = _retryStats; }
+    void resetRetryStats(void);
+    uint32_t averageLatency(void) { return _latencyAverage; }   // us, recent commands
+
+    // Card sessions
+    uint8_t checkSession(void);
+    uint16_t generation(void) { return _generation; }          // changes with every new card session
+    boolean inSession(void) { return fS50found; }
+    void setSessionTimeout(uint16_t timeout) { _sessionTimeout = timeout; }
+
+    // Scan pipeline
+    boolean setScan(const PN532ScanRange *ranges, uint8_t count, uint8_t *buffer, uint16_t size, PN532ScanCallback callback, void *context = 0);
+    int8_t scan(void);
+    void scanStats(PN532ScanStats *stats) { *stats = _scanStats; }
+    void resetScanStats(void);
+    uint32_t tapsPerSecond(void);
+
+    // Register access
+    boolean readRegisters(const uint16_t *addresses, uint8_t *values, uint8_t count);
+    boolean writeRegisters(const uint16_t *addresses, const uint8_t *values, uint8_t count);
+    boolean updateRegisters(const uint16_t *addresses, const uint8_t *masks, const uint8_t *values, uint8_t count);
+    boolean readRegister(uint16_t address, uint8_t *value) { return readRegisters(&address, value, 1); }
+    boolean writeRegister(uint16_t address, uint8_t value) { return writeRegisters(&address, &value, 1); }
+
+    // RF configuration
+    boolean rfConfiguration(uint8_t cfgItem, const uint8_t *cfgData, uint8_t len);
+    boolean setRFField(boolean rfOn, boolean autoRFCA = 0);
+    boolean setRFTimeouts(uint8_t atrResTimeout, uint8_t retryTimeout);
+    boolean setMaxRetryCOM(uint8_t maxRetryCOM);
+    boolean setMaxRetries(uint8_t maxRetryATR, uint8_t maxRetryPSL, uint8_t maxRetryPassiveActivation);
+    boolean setAnalogSettingsTypeA(const PN532AnalogTypeA *settings);
+    uint32_t measureDetectionLatency(uint8_t samples);
+    void sweepDetectionLatency(const uint8_t *retries, uint8_t count, uint8_t samples, uint32_t *latency);
     
     /**
     * @brief    Init PN532 as a target
@@ -129,14 +721,35 @@ public:
     int8_t tgInitAsTarget(uint16_t timeout = 0);
     int8_t tgInitAsTarget(const uint8_t* command, const uint8_t len, const uint16_t timeout = 0);
 
-    int16_t tgGetData(uint8_t *buf, uint8_t len);
+    int16_t tgGetData(uint8_t *buf, uint8_t len, uint16_t timeout = PN532_TIMEOUT);
     boolean tgSetData(const uint8_t *header, uint8_t hlen, const uint8_t *body = 0, uint8_t blen = 0);
 
     int16_t inRelease(const uint8_t relevantTarget = 0);
+    boolean inSelect(const uint8_t relevantTarget = 1);
 
     // ISO14443A functions
     boolean readPassiveTargetID(uint8_t cardbaudrate, uint8_t * uid, uint8_t * uidLength);
   
+    // Raw frame functions
+    int16_t inCommunicateThru(const uint8_t *data, uint8_t len, uint8_t *response, uint8_t responseSize);
+    boolean setCRC(boolean txCRC, boolean rxCRC);
+    boolean setParity(boolean enable);
+
+    // ISO14443-4 (ISO-DEP) functions
+    int16_t transceiveAPDU(const uint8_t *apdu, uint16_t apduLen, uint8_t *response, uint16_t responseSize, uint16_t *sw);
+
+    // NFC-DEP initiator functions
+    int8_t inJumpForDEP(uint8_t maxBaudrate = PN532_BAUDRATE_424K);
+    int32_t depTransceive(const uint8_t *out, uint16_t outLen, uint8_t *in, uint16_t inSize);
+    uint32_t depThroughput(void);
+
+    // FeliCa functions
+    boolean felica_Poll(uint8_t cardbaudrate, uint16_t systemCode, uint8_t * idm, uint8_t * pmm);
+    int8_t felica_ReadWithoutEncryption(uint8_t numService, const uint16_t * serviceCodes, uint8_t numBlock, const uint16_t * blockList, uint8_t * blockData);
+
+    // ISO14443B functions
+    boolean iso14443b_Poll(uint8_t afi, uint8_t * atqb);
+
     // Mifare Classic functions
     boolean mifareclassic_IsFirstBlock (uint32_t uiBlock);
     boolean mifareclassic_IsTrailerBlock (uint32_t uiBlock);
@@ -145,9 +758,15 @@ public:
     uint8_t mifareclassic_WriteDataBlock (uint8_t blockNumber, uint8_t * data);
     uint8_t mifareclassic_FormatNDEF (void);
     uint8_t mifareclassic_WriteNDEFURI (uint8_t sectorNumber, uint8_t uriIdentifier, const char * url);
+    uint8_t mifareclassic_WriteNDEFURI (uint8_t sectorNumber, const char * url);
+    uint8_t mifareclassic_ReadNDEF (uint8_t * uid, uint8_t uidLen, NDEFParser * parser);
+    uint8_t mifareclassic_WriteNDEF (uint8_t * uid, uint8_t uidLen, NDEFMessage * message);
     int write(unsigned int byteAddr, uint8_t byteData);
     int read(unsigned int byteAddr);
     int readBytes(uint8_t* buff, unsigned int byteAddrStart, unsigned int length);
+    int readStream(unsigned int byteAddrStart, unsigned int length, PN532ChunkCallback callback, void *context = 0);
+    int writeStream(unsigned int byteAddrStart, unsigned int length, PN532ChunkCallback callback, void *context = 0);
+    unsigned int dataCapacity(void);
     int writeBytes(uint8_t* buff, unsigned int byteAddrStart, unsigned int length);
     int availinfo();
     int available();
@@ -155,24 +774,90 @@ public:
     
     // Mifare Ultralight functions
     uint8_t mifareultralight_ReadPage (uint8_t page, uint8_t * buffer);
+    uint8_t mifareultralight_ReadPages (uint8_t page, uint8_t * buffer);
+    uint8_t mifareultralight_WritePage (uint8_t page, uint8_t * data);
+
+    // NTAG2xx / NFC Forum Type 2 Tag functions
+    uint8_t ntag2xx_ReadNDEF (NDEFParser * parser);
+    uint8_t ntag2xx_WriteNDEF (NDEFMessage * message);
+    int16_t ntag2xx_FastRead (uint8_t startPage, uint8_t endPage, uint8_t * buffer);
+    boolean ntag2xx_ReadCounter (uint32_t * counter);
+    boolean ntag2xx_PasswordAuth (const uint8_t * password, uint8_t * pack);
     
     
     //universal interface
-    boolean sendCommandCheckAck(uint8_t *cmd, uint8_t cmdlen);
+    boolean sendCommandCheckAck(uint8_t *cmd, uint8_t cmdlen, const uint8_t *body = 0, uint8_t bodylen = 0);
     
     // Help functions to display formatted text
     void PrintHex(const byte * data, const uint32_t numBytes);
     void PrintHexChar(const byte * pbtData, const uint32_t numBytes);
 private:
     Stream* _serial;
-    boolean fS50found;
+    boolean fS50found;  // a card session is active, for _uid
+    uint16_t _generation;
+    unsigned long _cardContact;  // millis() of the last successful card exchange
+    uint16_t _sessionTimeout;
     uint8_t data[16];
     uint8_t _uid[7];  // ISO14443A uid
     uint8_t uidLength;  // uid len
+    uint8_t _selRes;  // SEL_RES (SAK) of the listed card
+    uint16_t _capacity;  // data area of the card, see datacapacity
+    uint16_t _capacityGeneration;  // session _capacity was read in
+    uint8_t _authSector;  // sector blockaccess authenticated last
     uint8_t _key[6];  // Mifare Classic key
-    int8_t readdata(uint8_t* buff, uint8_t len); 
-    void writecommand(uint8_t* cmd, uint8_t cmdlen);
+    uint8_t _idm[8];  // FeliCa IDm of the last polled card
+    boolean _initialized;  // SAMConfig done and firmware cached, cleared on a missing ACK
+    uint8_t _firmware[4];
+    boolean _asleep;  // PN532 is in PowerDown, wake it before the next command
+    unsigned long _sleepStart;
+    PN532PowerStats _powerStats;
+    uint8_t _depTarget;  // NFC-DEP target number from InJumpForDEP
+    uint8_t _depBaudrate;
+    uint32_t _depBytes;  // bytes moved by the last depTransceive
+    uint32_t _depMicros;  // and the time it took
+    uint8_t _lastError;
+    uint8_t _lastStatus;
+    uint32_t _commandStart;
+    uint32_t _latencyAverage;
+    PN532RetryPolicy _retryPolicy;
+    PN532RetryStats _retryStats;
+    const PN532ScanRange *_scanRanges;
+    uint8_t _scanCount;
+    uint8_t *_scanBuffer;
+    uint16_t _scanLength;
+    PN532ScanCallback _scanCallback;
+    void *_scanContext;
+    uint16_t _scanGeneration;  // session of the card reported last
+    PN532ScanStats _scanStats;
+    uint16_t _scanMicros;      // part of a millisecond not yet in _scanStats
+#ifdef PN532STATS
+    PN532Stats _stats;
+#endif
+#ifdef PN532TRACE
+    PN532TraceHook _traceHook;
+    void *_traceContext;
+    uint8_t _traceCommand;
+    void trace(uint8_t type, const uint8_t *data = 0, uint16_t len = 0, const uint8_t *body = 0, uint16_t bodylen = 0);
+#endif
+    boolean waitavailable(uint16_t timeout);
+    void wakeup(void);
+    boolean initchip(void);
+    void scantime(uint32_t start);
+    uint8_t _frame[PN532_FRAMEBUFFSIZ];  // outgoing frame
+    boolean sendcheckack(const uint8_t *prebuilt, uint8_t *cmd, uint8_t cmdlen, const uint8_t *body, uint8_t bodylen);
+    void writecommand(const uint8_t *tmpl, uint8_t* cmd, uint8_t cmdlen, const uint8_t *body, uint8_t bodylen);
+    int16_t readframe(uint8_t command, uint8_t *head, uint8_t headlen, uint8_t *body = 0, uint16_t bodylen = 0);
+    int16_t frameerror(uint8_t error);
     boolean readack();
+    boolean checkstatus(uint8_t status);
+    boolean sessionready(void);
+    int blockaccess(uint8_t block, const uint8_t *update = 0, uint8_t offset = 0, uint8_t len = 0);
+    int8_t blockattempt(uint8_t block, const uint8_t *update, uint8_t offset, uint8_t len);
+    int streamdata(unsigned int byteAddrStart, unsigned int length, PN532ChunkCallback callback, void *context, boolean writing);
+    uint8_t datablock(unsigned int index);
+    int datacapacity(void);
+    uint8_t authenticate_P(uint8_t *uid, uint8_t uidLen, uint32_t blockNumber, uint8_t keyNumber, const uint8_t *keyData);
+    int32_t indataexchange(uint8_t tg, const uint8_t *out, uint16_t outLen, uint8_t *in, uint16_t inSize);
     
 };
 
@@ -17,6 +17,8 @@
 /***********Notice and Trouble shooting***************
  1.The address is from 0 to 751, 752 Bytes in the data blocks. 
  2.This code is tested on Arduino Uno.
+ 3.The data buffer takes 752 bytes of RAM, readStream hands the data over
+   one block at a time instead.
  ****************************************************/
  
 #include "Arduino.h"
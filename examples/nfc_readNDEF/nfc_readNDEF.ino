@@ -0,0 +1,61 @@
+/***************************************************
+      NFC Module for Arduino (SKU:DFR0231)
+ <http://www.dfrobot.com/wiki/index.php/NFC_Module_for_Arduino_%28SKU:DFR0231%29>
+ ***************************************************
+ This example reads the NDEF message of an NFC Forum formatted Mifare
+ Classic card and prints the type and payload of each record.
+ 
+ GNU Lesser General Public License. 
+ See <http://www.gnu.org/licenses/> for details.
+ All above must be included in any redistribution
+ ****************************************************/
+
+/***********Notice and Trouble shooting***************
+ 1.The card must be formatted for NDEF (e.g. with NXP TagWriter).
+ 2.Messages longer than the buffer below are rejected.
+ ****************************************************/
+ 
+#include "Arduino.h"
+#include "DFRNFC.h"
+
+DFRNFC nfc; 
+
+uint8_t message[128];
+NDEFParser parser(message, sizeof(message));
+
+void setup(void)
+{
+  Serial.begin(115200); //PN532 default SerialBaudRate is 115200
+  
+  //initialize nfc module
+  nfc.begin(Serial);
+  Serial.println("Looking for PN532...");
+}
+
+
+void loop()
+{
+  uint8_t uid[7];
+  uint8_t uidLength;
+  NDEFRecord record;
+  
+  if(!nfc.readPassiveTargetID(PN532_MIFARE_ISO14443A, uid, &uidLength))
+    return;
+  
+  if(!nfc.mifareclassic_ReadNDEF(uid, uidLength, &parser))
+  {
+    Serial.println("failed to read the NDEF message");
+    return;
+  }
+  
+  while(parser.nextRecord(&record))
+  {
+    Serial.print("TNF ");
+    Serial.print(record.header & NDEF_RECORD_TNF_MASK, DEC);
+    Serial.print(" type ");
+    nfc.PrintHexChar(record.type, record.typeLength);
+    nfc.PrintHexChar(record.payload, record.payloadLength);
+  }
+  
+  while(1);
+}
@@ -0,0 +1,51 @@
+/***************************************************
+      NFC Module for Arduino (SKU:DFR0231)
+ <http://www.dfrobot.com/wiki/index.php/NFC_Module_for_Arduino_%28SKU:DFR0231%29>
+ ***************************************************
+ This example reads blocks 4 and 5 of every Mifare Classic card held to
+ the reader with the scan pipeline and prints the uid and the data once
+ per tap, then the number of cards read per second.
+ 
+ GNU Lesser General Public License. 
+ See <http://www.gnu.org/licenses/> for details.
+ All above must be included in any redistribution
+ ****************************************************/
+
+/***********Notice and Trouble shooting***************
+ 1.The blocks are read with the default key A {0xFF,0xFF,0xFF,0xFF,0xFF,0xFF}.
+ 2.A card is reported again only after it left the field.
+ ****************************************************/
+ 
+#include "Arduino.h"
+#include "DFRNFC.h"
+
+DFRNFC nfc; 
+
+const uint8_t key[6] = {0xFF,0xFF,0xFF,0xFF,0xFF,0xFF};
+const PN532ScanRange ranges[] = {{4, 2, 0, key}};   // blocks 4 and 5, key A
+uint8_t blocks[32];
+
+void onCard(const uint8_t *uid, uint8_t uidLength, const uint8_t *data, uint16_t len, void *context)
+{
+  nfc.PrintHex(uid, uidLength);
+  nfc.PrintHexChar(data, len);
+  Serial.print(nfc.tapsPerSecond());
+  Serial.println(" cards/s");
+}
+
+void setup(void)
+{
+  Serial.begin(115200); //PN532 default SerialBaudRate is 115200
+  
+  //initialize nfc module and the scan pipeline
+  nfc.begin(Serial);
+  nfc.setScan(ranges, 1, blocks, sizeof(blocks), onCard);
+  Serial.println("Looking for PN532...");
+}
+
+
+void loop()
+{
+  if(nfc.scan() == -1)
+    Serial.println("failed to find PN532");
+}
@@ -0,0 +1,91 @@
+/***************************************************
+ Minimal Arduino core for the host tools, see Arduino.h
+
+ GNU Lesser General Public License.
+ See <http://www.gnu.org/licenses/> for details.
+ ****************************************************/
+
+#include "Arduino.h"
+
+#include <stdio.h>
+#include <time.h>
+
+static uint64_t nowMicros(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static const uint64_t startMicros = nowMicros();
+static uint64_t advancedMicros = 0;
+
+unsigned long millis(void)
+{
+    return (uint32_t)((nowMicros() - startMicros + advancedMicros) / 1000);
+}
+
+unsigned long micros(void)
+{
+    return (uint32_t)(nowMicros() - startMicros + advancedMicros);
+}
+
+void hostAdvance(unsigned long us)
+{
+    advancedMicros += us;
+}
+
+// Nothing on the host needs the time to really pass
+void delay(unsigned long ms)
+{
+    hostAdvance(ms * 1000);
+}
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+    size_t n = 0;
+    while (n < size && write(buffer[n]))
+        n++;
+    return n;
+}
+
+size_t Print::print(unsigned long n, int base)
+{
+    char buf[24];
+    snprintf(buf, sizeof(buf), (base == HEX) ? "%lX" : "%lu", n);
+    return write(buf);
+}
+
+size_t Print::print(long n, int base)
+{
+    if (base != DEC)
+        return print((unsigned long)n, base);
+    char buf[24];
+    snprintf(buf, sizeof(buf), "%ld", n);
+    return write(buf);
+}
+
+int Stream::timedRead(void)
+{
+    unsigned long start = millis();
+    do
+    {
+        int c = read();
+        if (c >= 0)
+            return c;
+    } while (millis() - start < _timeout);
+    return -1;
+}
+
+size_t Stream::readBytes(uint8_t *buffer, size_t length)
+{
+    size_t n = 0;
+    while (n < length)
+    {
+        int c = timedRead();
+        if (c < 0)
+            break;
+        buffer[n++] = c;
+    }
+    return n;
+}
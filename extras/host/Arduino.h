@@ -0,0 +1,79 @@
+/***************************************************
+ Minimal Arduino core for building DFRNFC on a PC, used by the host
+ tools in this directory. It only covers what the library needs:
+ Print, Stream, the PROGMEM helpers and the time functions. Flash and
+ RAM are the same thing here, so the _P functions are the plain ones.
+
+ GNU Lesser General Public License.
+ See <http://www.gnu.org/licenses/> for details.
+ ****************************************************/
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define HEX 16
+#define DEC 10
+
+#define PROGMEM
+#define PGM_P const char *
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define memcpy_P memcpy
+#define memcmp_P memcmp
+#define strlen_P strlen
+#define strncmp_P strncmp
+#define F(s) (s)
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+
+// Host only: moves millis and micros ahead, so a simulated device can
+// let time pass (a timeout, the wire) without the host waiting for it
+void hostAdvance(unsigned long us);
+
+class Print
+{
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t b) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size);
+    size_t write(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+
+    size_t print(const char *s) { return write(s); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(unsigned long n, int base = DEC);
+    size_t print(long n, int base = DEC);
+    size_t print(unsigned int n, int base = DEC) { return print((unsigned long)n, base); }
+    size_t print(int n, int base = DEC) { return print((long)n, base); }
+    size_t print(unsigned char n, int base = DEC) { return print((unsigned long)n, base); }
+    size_t println(void) { return write("\r\n"); }
+    template <typename T> size_t println(T value) { return print(value) + println(); }
+    template <typename T> size_t println(T value, int base) { return print(value, base) + println(); }
+};
+
+class Stream : public Print
+{
+public:
+    Stream() : _timeout(1000) {}
+    virtual int available(void) = 0;
+    virtual int read(void) = 0;
+    virtual int peek(void) = 0;
+    virtual void flush(void) {}
+
+    void setTimeout(unsigned long timeout) { _timeout = timeout; }
+    size_t readBytes(uint8_t *buffer, size_t length);
+    size_t readBytes(char *buffer, size_t length) { return readBytes((uint8_t *)buffer, length); }
+protected:
+    unsigned long _timeout;
+    int timedRead(void);
+};
+
+#endif
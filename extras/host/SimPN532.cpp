@@ -0,0 +1,270 @@
+/***************************************************
+ Simulated PN532 on the HSU for the host tools, see SimPN532.h
+
+ GNU Lesser General Public License.
+ See <http://www.gnu.org/licenses/> for details.
+ ****************************************************/
+
+#include "SimPN532.h"
+#include "DFRNFC.h"
+
+#define SIM_IDLE_MICROS                     (100)   // clock step while the library polls for nothing
+
+static const uint8_t transportTrailer[16] = {0xFF,0xFF,0xFF,0xFF,0xFF,0xFF, 0xFF,0x07,0x80,0x69, 0xFF,0xFF,0xFF,0xFF,0xFF,0xFF};
+
+SimPN532::SimPN532(uint8_t card)
+{
+    commands = 0;
+    _outStart = 0;
+    _outLength = 0;
+    _inLength = 0;
+    setCard(card);
+}
+
+/**************************************************************************/
+/*!
+    @brief  Puts a fresh card in the field: a Classic card with the
+            transport trailers, or an NTAG216 with an empty NDEF CC
+*/
+/**************************************************************************/
+void SimPN532::setCard(uint8_t card)
+{
+    static const uint8_t defaultUid[7] = {0x04, 0x5E, 0x1A, 0x0B, 0x01, 0x2C, 0x80};
+
+    _card = card;
+    _authSector = -1;
+    memcpy(uid, defaultUid, sizeof(uid));
+    uid[2] += card;     // another type is another card, not the same one changed
+    memset(_memory, 0, sizeof(_memory));
+
+    if (card == SIM_CARD_NTAG216)
+    {
+        memcpy(page(0), uid, 3);
+        page(0)[3] = 0x88 ^ uid[0] ^ uid[1] ^ uid[2];
+        memcpy(page(1), uid+3, 4);
+        page(2)[0] = uid[3] ^ uid[4] ^ uid[5] ^ uid[6];
+        page(3)[0] = 0xE1;      // CC: NDEF, version 1.0, 872 bytes, read/write
+        page(3)[1] = 0x10;
+        page(3)[2] = 0x6D;
+    }
+    else if (card != SIM_CARD_NONE)
+    {
+        memcpy(block(0), uid, 4);
+        block(0)[4] = uid[0] ^ uid[1] ^ uid[2] ^ uid[3];
+        for (uint8_t sector = 0; sector < ((card == SIM_CARD_MIFARE_4K) ? 40 : 16); sector++)
+            memcpy(block((sector < 32) ? sector*4 + 3 : 128 + (sector-32)*16 + 15), transportTrailer, 16);
+    }
+}
+
+uint16_t SimPN532::blocks(void)
+{
+    return (_card == SIM_CARD_MIFARE_4K) ? 256 : 64;
+}
+
+int SimPN532::available(void)
+{
+    if (!_outLength)
+        hostAdvance(SIM_IDLE_MICROS);
+    return _outLength;
+}
+
+int SimPN532::read(void)
+{
+    if (!_outLength)
+    {
+        hostAdvance(SIM_IDLE_MICROS);
+        return -1;
+    }
+    uint8_t b = _out[_outStart];
+    _outStart = (_outStart + 1) % SIM_OUTBUFFSIZ;
+    _outLength--;
+    return b;
+}
+
+int SimPN532::peek(void)
+{
+    return _outLength ? _out[_outStart] : -1;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Collects the bytes of the library into frames. Wake-up bytes
+            and anything else outside a frame are skipped, ACKs from the
+            host are dropped
+*/
+/**************************************************************************/
+size_t SimPN532::write(uint8_t b)
+{
+    if (_inLength < sizeof(_in))
+        _in[_inLength++] = b;
+
+    while (_inLength >= 4)
+    {
+        uint8_t len = _in[2];
+        if ((_in[0] != PN532_STARTCODE1) || (_in[1] != PN532_STARTCODE2) || ((uint8_t)(len + _in[3]) != 0))
+        {
+            memmove(_in, _in+1, --_inLength);   // not the start of a frame
+            continue;
+        }
+        uint16_t size = len ? len + 6 : 5;    // 00 FF LEN LCS data DCS 00, or an ACK
+        if (_inLength < size)
+            break;
+
+        if (len && (_in[4] == PN532_HOSTTOPN532))
+        {
+            uint8_t sum = 0;
+            for (uint8_t i = 0; i < len + 1; i++)
+                sum += _in[4+i];
+            if (sum == 0)
+            {
+                commands++;
+                _responseCode = _in[5] + 1;
+                handle(_in+5, len-1);
+            }
+        }
+        _inLength -= size;
+        memmove(_in, _in+size, _inLength);
+    }
+    return 1;
+}
+
+void SimPN532::send(const uint8_t *wire, uint16_t len)
+{
+    for (uint16_t i = 0; i < len && _outLength < SIM_OUTBUFFSIZ; i++)
+        _out[(_outStart + _outLength++) % SIM_OUTBUFFSIZ] = wire[i];
+}
+
+void SimPN532::reply(const uint8_t *data, uint8_t len)
+{
+    static const uint8_t ack[6] = {0x00, 0x00, 0xFF, 0x00, 0xFF, 0x00};
+    uint8_t frame[262];
+    uint8_t sum = PN532_PN532TOHOST + _responseCode;
+
+    send(ack, 6);
+    frame[0] = PN532_PREAMBLE;
+    frame[1] = PN532_STARTCODE1;
+    frame[2] = PN532_STARTCODE2;
+    frame[3] = len + 2;
+    frame[4] = ~(len + 2) + 1;
+    frame[5] = PN532_PN532TOHOST;
+    frame[6] = _responseCode;
+    for (uint8_t i = 0; i < len; i++)
+    {
+        frame[7+i] = data[i];
+        sum += data[i];
+    }
+    frame[7+len] = ~sum + 1;
+    frame[8+len] = PN532_POSTAMBLE;
+    send(frame, len + 9);
+}
+
+void SimPN532::handle(const uint8_t *cmd, uint8_t len)
+{
+    uint8_t data[16] = {0};
+
+    switch (cmd[0])
+    {
+        case PN532_COMMAND_GETFIRMWAREVERSION:
+            data[0] = 0x32;
+            data[1] = 0x01;
+            data[2] = 0x06;
+            data[3] = 0x07;
+            reply(data, 4);
+            break;
+        case PN532_COMMAND_INLISTPASSIVETARGET:
+            _authSector = -1;
+            if (_card == SIM_CARD_NONE)
+            {
+                data[0] = 0;    // NbTg
+                reply(data, 1);
+                break;
+            }
+            data[0] = 1;
+            data[1] = 1;
+            data[2] = 0x00;
+            data[3] = (_card == SIM_CARD_NTAG216) ? 0x44 : (_card == SIM_CARD_MIFARE_4K) ? 0x02 : 0x04;
+            data[4] = (_card == SIM_CARD_NTAG216) ? 0x00 : (_card == SIM_CARD_MIFARE_4K) ? 0x18 : 0x08;
+            data[5] = (_card == SIM_CARD_NTAG216) ? 7 : 4;
+            memcpy(data+6, uid, data[5]);
+            reply(data, 6 + data[5]);
+            break;
+        case PN532_COMMAND_INDATAEXCHANGE:
+            dataexchange(cmd, len);
+            break;
+        case PN532_COMMAND_READREGISTER:
+            memset(data, 0, sizeof(data));
+            reply(data, ((len - 1) / 2 < 16) ? (len - 1) / 2 : 16);
+            break;
+        case PN532_COMMAND_POWERDOWN:
+        case PN532_COMMAND_INDESELECT:
+        case PN532_COMMAND_INRELEASE:
+        case PN532_COMMAND_INSELECT:
+            data[0] = 0;    // status
+            reply(data, 1);
+            break;
+        default:
+            reply(data, 0);
+            break;
+    }
+}
+
+/**************************************************************************/
+/*!
+    @brief  InDataExchange with the card: Mifare authentication, read and
+            write, NTAG read and page write. Errors come back as status
+            0x14 like a rejected Mifare command, 0x01 without a card
+*/
+/**************************************************************************/
+void SimPN532::dataexchange(const uint8_t *cmd, uint8_t len)
+{
+    uint8_t data[17];
+    uint8_t op = (len > 2) ? cmd[2] : 0;
+    uint8_t addr = (len > 3) ? cmd[3] : 0;
+
+    data[0] = 0x14;
+    if (_card == SIM_CARD_NONE || len < 4)
+        data[0] = 0x01;
+    else if (_card == SIM_CARD_NTAG216)
+    {
+        if (op == MIFARE_CMD_READ && addr < SIM_NTAG216_PAGES)
+        {
+            data[0] = 0;
+            for (uint8_t i = 0; i < 16; i++)
+                data[1+i] = _memory[((addr + i/4) % SIM_NTAG216_PAGES) * 4 + i%4];
+            reply(data, 17);
+            return;
+        }
+        if (op == MIFARE_CMD_WRITE_ULTRALIGHT && len == 8 && addr >= 4 && addr < 226)
+        {
+            memcpy(page(addr), cmd+4, 4);
+            data[0] = 0;
+        }
+    }
+    else if (addr < blocks())
+    {
+        int16_t sector = (addr < 128) ? addr / 4 : 32 + (addr - 128) / 16;
+        uint8_t *trailer = block((addr < 128) ? sector*4 + 3 : 128 + (sector-32)*16 + 15);
+        if ((op == MIFARE_CMD_AUTH_A || op == MIFARE_CMD_AUTH_B) && len >= 10)
+        {
+            _authSector = -1;
+            if (!memcmp(cmd+4, trailer + ((op == MIFARE_CMD_AUTH_A) ? 0 : 10), 6))
+            {
+                _authSector = sector;
+                data[0] = 0;
+            }
+        }
+        else if (op == MIFARE_CMD_READ && sector == _authSector)
+        {
+            data[0] = 0;
+            memcpy(data+1, block(addr), 16);
+            reply(data, 17);
+            return;
+        }
+        else if (op == MIFARE_CMD_WRITE && len == 20 && sector == _authSector && addr != 0)
+        {
+            memcpy(block(addr), cmd+4, 16);
+            data[0] = 0;
+        }
+    }
+    reply(data, 1);
+}
@@ -0,0 +1,61 @@
+/***************************************************
+ Simulated PN532 on the HSU for the host tools. It answers the commands
+ of DFRNFC like a PN532 with one card in the field: a Mifare Classic 1K
+ or 4K with the transport keys (0xFF..) in every trailer, or an NTAG216
+ with an empty NDEF capability container. While the library waits for
+ an answer the simulated clock runs (hostAdvance), so timeouts cost no
+ real time.
+
+ GNU Lesser General Public License.
+ See <http://www.gnu.org/licenses/> for details.
+ ****************************************************/
+
+#ifndef SIMPN532_H
+#define SIMPN532_H
+
+#include "Arduino.h"
+
+#define SIM_CARD_NONE                       (0)
+#define SIM_CARD_MIFARE_1K                  (1)
+#define SIM_CARD_MIFARE_4K                  (2)
+#define SIM_CARD_NTAG216                    (3)
+
+#define SIM_NTAG216_PAGES                   (231)
+#define SIM_OUTBUFFSIZ                      (512)
+
+class SimPN532 : public Stream
+{
+public:
+    SimPN532(uint8_t card = SIM_CARD_MIFARE_1K);
+    void setCard(uint8_t card);
+    uint8_t card(void) { return _card; }
+    uint8_t *block(uint8_t number) { return _memory + number*16; }   // Mifare Classic
+    uint8_t *page(uint8_t number) { return _memory + number*4; }     // NTAG216
+    uint8_t uid[7];
+    uint32_t commands;      // command frames received
+
+    virtual int available(void);
+    virtual int read(void);
+    virtual int peek(void);
+    virtual size_t write(uint8_t b);
+    using Print::write;
+protected:
+    // A complete command: code and parameters, without TFI
+    virtual void handle(const uint8_t *cmd, uint8_t len);
+    void reply(const uint8_t *data, uint8_t len);   // ACK and a response frame with data after the response code
+    void send(const uint8_t *wire, uint16_t len);   // raw bytes on the wire
+    uint8_t _responseCode;  // code of the response to the current command
+private:
+    uint8_t _card;
+    uint8_t _memory[4096];
+    int16_t _authSector;    // -1 if none
+    uint8_t _out[SIM_OUTBUFFSIZ];
+    uint16_t _outStart;
+    uint16_t _outLength;
+    uint8_t _in[262];
+    uint16_t _inLength;
+    void dataexchange(const uint8_t *cmd, uint8_t len);
+    uint16_t blocks(void);
+};
+
+#endif
@@ -0,0 +1,240 @@
+/***************************************************
+ Decodes a capture saved with PN532Capture::dump and replays it to
+ DFRNFC through PN532ReplayStream, on a PC instead of the Arduino.
+
+   capture [-t] dump
+
+ The dump is the raw output of dump(), or the same bytes as hex text.
+ Every captured command is issued again through the library function
+ that sends it, so the response is parsed the way the sketch saw it;
+ commands without such a function are sent as they are and their
+ response is skipped. -t plays the responses with the captured delays.
+ The exit code is 1 when a command did not come out as captured.
+
+ GNU Lesser General Public License.
+ See <http://www.gnu.org/licenses/> for details.
+ ****************************************************/
+
+#include "Arduino.h"
+#include "DFRNFC.h"
+
+#include <ctype.h>
+#include <stdio.h>
+
+class StdoutPrint : public Print
+{
+public:
+    virtual size_t write(uint8_t b) { return fputc(b, stdout) == EOF ? 0 : 1; }
+    using Print::write;
+};
+
+static uint8_t captureBuffer[65535];
+
+// Reads the dump, hex text if the file has nothing else
+static long loaddump(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return -1;
+    long n = fread(captureBuffer, 1, sizeof(captureBuffer), f);
+    fclose(f);
+
+    boolean hex = (n > 0);
+    for (long i = 0; i < n && hex; i++)
+        hex = isxdigit(captureBuffer[i]) || isspace(captureBuffer[i]);
+    if (!hex)
+        return n;
+
+    long out = 0;
+    int high = -1;
+    for (long i = 0; i < n; i++)
+    {
+        if (isspace(captureBuffer[i]))
+            continue;
+        char c = captureBuffer[i];
+        int nibble = isdigit(c) ? c - '0' : (tolower(c) - 'a' + 10);
+        if (high < 0)
+            high = nibble;
+        else
+        {
+            captureBuffer[out++] = (high << 4) | nibble;
+            high = -1;
+        }
+    }
+    return out;
+}
+
+static void printhex(const uint8_t *data, uint8_t len)
+{
+    for (uint8_t i = 0; i < len; i++)
+        printf(" %02X", data[i]);
+}
+
+// Sends a command as captured and skips its response
+static boolean sendraw(DFRNFC &nfc, PN532ReplayStream &replay, uint8_t *cmd, uint8_t len)
+{
+    if (!nfc.sendCommandCheckAck(cmd, len))
+        return 0;
+    unsigned long start = millis();
+    while (!replay.available() && millis() - start < PN532_TIMEOUT)
+        ;
+    while (replay.available())
+        replay.read();
+    return 1;
+}
+
+/*
+ * Issues one captured command (command code and parameters) through
+ * the library, returns the result of the call
+ */
+static boolean reissue(DFRNFC &nfc, PN532ReplayStream &replay, uint8_t *cmd, uint8_t len)
+{
+    uint8_t buf[64];
+    uint8_t n;
+
+    switch (cmd[0])
+    {
+        case PN532_COMMAND_GETFIRMWAREVERSION:
+            if (len != 1)
+                break;
+            if (!nfc.getFirmwareVersion(buf))
+                return 0;
+            printf("  version"); printhex(buf, 4); printf("\n");
+            return 1;
+        case PN532_COMMAND_SAMCONFIGURATION:
+            if (len != 4 || cmd[1] != 0x01)
+                break;
+            return nfc.SAMConfig(cmd[2], cmd[3]);
+        case PN532_COMMAND_RFCONFIGURATION:
+            if (len < 2)
+                break;
+            return nfc.rfConfiguration(cmd[1], cmd+2, len-2);
+        case PN532_COMMAND_READREGISTER:
+        case PN532_COMMAND_WRITEREGISTER:
+        {
+            // as many registers as readRegisters / writeRegisters put in one frame
+            uint8_t step = (cmd[0] == PN532_COMMAND_READREGISTER) ? 2 : 3;
+            uint16_t addresses[31];
+            if ((len - 1) % step || (len - 1) / step > 63 / step)
+                break;
+            n = (len - 1) / step;
+            for (uint8_t i = 0; i < n; i++)
+            {
+                addresses[i] = (cmd[1+i*step] << 8) | cmd[2+i*step];
+                buf[i] = cmd[3+i*step];
+            }
+            if (step == 3)
+                return nfc.writeRegisters(addresses, buf, n);
+            if (!nfc.readRegisters(addresses, buf, n))
+                return 0;
+            printf("  registers"); printhex(buf, n); printf("\n");
+            return 1;
+        }
+        case PN532_COMMAND_INLISTPASSIVETARGET:
+            if (len != 3 || cmd[1] != 1 || cmd[2] != PN532_MIFARE_ISO14443A)
+                break;
+            if (!nfc.readPassiveTargetID(cmd[2], buf, &n))
+                return 0;
+            printf("  uid"); printhex(buf, n); printf("\n");
+            return 1;
+        case PN532_COMMAND_INSELECT:
+            if (len != 2)
+                break;
+            return nfc.inSelect(cmd[1]);
+        case PN532_COMMAND_INRELEASE:
+            if (len != 2)
+                break;
+            return nfc.inRelease(cmd[1]) >= 0;
+        case PN532_COMMAND_INCOMMUNICATETHRU:
+        {
+            int16_t got = nfc.inCommunicateThru(cmd+1, len-1, buf, sizeof(buf));
+            if (got < 0)
+                return 0;
+            printf("  answer"); printhex(buf, got); printf("\n");
+            return 1;
+        }
+        case PN532_COMMAND_INDATAEXCHANGE:
+            if (len < 4 || cmd[1] != 1)
+                break;
+            switch (cmd[2])
+            {
+                case MIFARE_CMD_AUTH_A:
+                case MIFARE_CMD_AUTH_B:
+                    if (len != 14 && len != 17)
+                        break;
+                    return nfc.mifareclassic_AuthenticateBlock(cmd+10, len-10, cmd[3], cmd[2] == MIFARE_CMD_AUTH_B, cmd+4);
+                case MIFARE_CMD_READ:
+                    if (len != 4)
+                        break;
+                    if (!nfc.mifareclassic_ReadDataBlock(cmd[3], buf))
+                        return 0;
+                    printf("  block %u", cmd[3]); printhex(buf, 16); printf("\n");
+                    return 1;
+                case MIFARE_CMD_WRITE:
+                    if (len != 20)
+                        break;
+                    return nfc.mifareclassic_WriteDataBlock(cmd[3], cmd+4);
+                case MIFARE_CMD_WRITE_ULTRALIGHT:
+                    if (len != 8)
+                        break;
+                    return nfc.mifareultralight_WritePage(cmd[3], cmd+4);
+            }
+            break;
+    }
+    printf("  sent as captured\n");
+    return sendraw(nfc, replay, cmd, len);
+}
+
+int main(int argc, char **argv)
+{
+    boolean timing = 0;
+    int arg = 1;
+    if (arg < argc && !strcmp(argv[arg], "-t"))
+    {
+        timing = 1;
+        arg++;
+    }
+    if (arg + 1 != argc)
+    {
+        fprintf(stderr, "usage: %s [-t] dump\n", argv[0]);
+        return 2;
+    }
+
+    long length = loaddump(argv[arg]);
+    if (length < 0)
+    {
+        perror(argv[arg]);
+        return 2;
+    }
+    PN532Capture capture(captureBuffer, sizeof(captureBuffer), length);
+    StdoutPrint out;
+    capture.decode(out);
+
+    PN532ReplayStream replay(&capture, timing);
+    DFRNFC nfc;
+    nfc.begin(replay);
+    replay.rewind();    // begin talked to the capture too
+
+    printf("\nreplay\n");
+    for (uint16_t pos = 0; pos < capture.length(); pos += PN532_CAPTURE_HEADER + capture.byteAt(pos+5))
+    {
+        if (capture.byteAt(pos) != PN532_TRACE_TX)
+            continue;
+        uint8_t cmd[255];
+        uint8_t len = capture.byteAt(pos+5);
+        for (uint8_t i = 0; i < len; i++)
+            cmd[i] = capture.byteAt(pos+PN532_CAPTURE_HEADER+i);
+        if (!len)
+            continue;
+
+        uint16_t mismatches = replay.mismatches();
+        printf("%02X", cmd[0]);
+        printhex(cmd+1, len-1);
+        printf("\n");
+        boolean ok = reissue(nfc, replay, cmd, len);
+        printf("  %s%s\n", ok ? "ok" : "failed", (replay.mismatches() != mismatches) ? ", not as captured" : "");
+    }
+
+    printf("\n%u commands, %u not as captured\n", replay.frames(), replay.mismatches());
+    return replay.mismatches() ? 1 : 0;
+}
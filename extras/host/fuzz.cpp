@@ -0,0 +1,556 @@
+/***************************************************
+ Fuzz and property targets for DFRNFC on the host. The first input
+ byte selects the target:
+
+   0  frame       a response frame built from the input, intact or
+                  broken, answers a command of a public function
+   1  ndef        NDEFParser on a raw TLV stream, and NDEFMessage
+                  records parsed back after the TLV round trip
+   2  address     readBytes/writeBytes/read/write/readStream with
+                  (start, length) pairs on a simulated Mifare 1K, 4K
+                  or NTAG216 against a model of the data area
+
+ A failed check prints the target and aborts. Built with LIBFUZZER the
+ file is a libFuzzer target, else a driver that runs the given input
+ files, or random inputs:
+
+   fuzz [-n runs] [-s seed] [file...]
+
+ With PN532STATS the driver ends with the decode cost per frame.
+
+ GNU Lesser General Public License.
+ See <http://www.gnu.org/licenses/> for details.
+ ****************************************************/
+
+#include "Arduino.h"
+#include "DFRNFC.h"
+#include "SimPN532.h"
+
+#include <stdio.h>
+
+#define FUZZ_FRAME                          (0)
+#define FUZZ_NDEF                           (1)
+#define FUZZ_ADDRESS                        (2)
+#define FUZZ_TARGETS                        (3)
+
+// flags of the frame target
+#define FUZZ_BAD_CODE                       (0x01)  // another response code
+#define FUZZ_BAD_LEN                        (0x02)  // LEN with a matching LCS, but wrong
+#define FUZZ_BAD_LCS                        (0x04)
+#define FUZZ_BAD_DCS                        (0x08)
+#define FUZZ_TRUNCATE                       (0x10)  // the frame stops halfway
+#define FUZZ_NO_ACK                         (0x20)
+
+#define FUZZ_MAX_INPUT                      (1024)
+
+static void fail(const char *target, const char *what)
+{
+    fprintf(stderr, "%s: %s\n", target, what);
+    abort();
+}
+
+#define CHECK(target, condition) do { if (!(condition)) fail(target, #condition); } while (0)
+
+
+/***** Frame target ******/
+
+/*
+ * Answers the next command with a frame made of the input: the payload
+ * after the response code, broken as the flags say. Later commands of
+ * the same call get the answers of the simulated card.
+ */
+class FramePN532 : public SimPN532
+{
+public:
+    FramePN532() : SimPN532(SIM_CARD_MIFARE_1K), _payload(0) {}
+    void arm(const uint8_t *payload, uint8_t len, uint8_t flags)
+    {
+        _payload = payload;
+        _len = len;
+        _flags = flags;
+    }
+protected:
+    virtual void handle(const uint8_t *cmd, uint8_t len)
+    {
+        if (!_payload)
+        {
+            SimPN532::handle(cmd, len);
+            return;
+        }
+
+        static const uint8_t ack[6] = {0x00, 0x00, 0xFF, 0x00, 0xFF, 0x00};
+        uint8_t wire[262];
+        uint8_t code = (_flags & FUZZ_BAD_CODE) ? (_len ? _payload[0] : 0) : _responseCode;
+        uint8_t length = _len + 2;
+        if (_flags & FUZZ_BAD_LEN)
+            length += 1 + (_flags >> 6);
+        uint8_t sum = PN532_PN532TOHOST + code;
+
+        wire[0] = PN532_PREAMBLE;
+        wire[1] = PN532_STARTCODE1;
+        wire[2] = PN532_STARTCODE2;
+        wire[3] = length;
+        wire[4] = ~length + 1 + ((_flags & FUZZ_BAD_LCS) ? 1 : 0);
+        wire[5] = PN532_PN532TOHOST;
+        wire[6] = code;
+        for (uint8_t i = 0; i < _len; i++)
+        {
+            wire[7+i] = _payload[i];
+            sum += _payload[i];
+        }
+        wire[7+_len] = ~sum + 1 + ((_flags & FUZZ_BAD_DCS) ? 1 : 0);
+        wire[8+_len] = PN532_POSTAMBLE;
+
+        if (!(_flags & FUZZ_NO_ACK))
+            send(ack, 6);
+        send(wire, (_flags & FUZZ_TRUNCATE) ? (_len + 9) / 2 : _len + 9);
+        _payload = 0;
+    }
+private:
+    const uint8_t *_payload;
+    uint8_t _len;
+    uint8_t _flags;
+};
+
+static FramePN532 frameSim;
+static DFRNFC frameNfc;
+
+/*
+ * input: function, flags, argument, payload. Checks that no function
+ * reports more data than its buffer holds; the sanitizers catch any
+ * access past the frame.
+ */
+static void fuzzframe(const uint8_t *data, size_t size)
+{
+    static const char target[] = "frame";
+    DFRNFC &nfc = frameNfc;
+    uint8_t buf[256];
+    uint8_t uid[7];
+    uint8_t uidLength = 0xEE;
+    uint16_t sw;
+    uint32_t counter;
+
+    if (size < 3)
+        return;
+    uint8_t function = data[0];
+    uint8_t arg = data[2];
+    frameSim.arm(data+3, (size - 3 > 252) ? 252 : size - 3, data[1]);
+
+    switch (function % 14)
+    {
+        case 0:
+            nfc.getFirmwareVersion(buf);
+            break;
+        case 1:
+            if (nfc.readPassiveTargetID(PN532_MIFARE_ISO14443A, uid, &uidLength))
+                CHECK(target, uidLength <= 7);
+            break;
+        case 2:
+            nfc.mifareclassic_ReadDataBlock(arg, buf);
+            break;
+        case 3:
+            memset(uid, 0, sizeof(uid));
+            nfc.mifareclassic_AuthenticateBlock(uid, 4, arg, arg & 1, buf);
+            break;
+        case 4:
+            nfc.mifareultralight_ReadPages(arg, buf);
+            break;
+        case 5:
+            nfc.felica_Poll(PN532_FELICA_212, 0xFFFF, buf, buf+8);
+            break;
+        case 6:
+            nfc.iso14443b_Poll(arg, buf);
+            break;
+        case 7:
+            nfc.ntag2xx_ReadCounter(&counter);
+            break;
+        case 8:
+        {
+            uint8_t cmd[2] = {MIFARE_CMD_READ, arg};
+            int16_t n = nfc.inCommunicateThru(cmd, 2, buf, arg % 32);
+            CHECK(target, n <= arg % 32);
+            break;
+        }
+        case 9:
+        {
+            uint16_t addresses[3] = {0x6302, 0x6303, 0x6305};
+            nfc.readRegisters(addresses, buf, 3);
+            break;
+        }
+        case 10:
+        {
+            uint8_t apdu[5] = {0x00, 0xA4, 0x04, 0x00, 0x00};
+            int16_t n = nfc.transceiveAPDU(apdu, 5, buf, arg, &sw);
+            CHECK(target, n <= arg);
+            break;
+        }
+        case 11:
+        {
+            int16_t n = nfc.tgGetData(buf, arg % 64, 10);
+            CHECK(target, n <= arg % 64);
+            break;
+        }
+        case 12:
+        {
+            uint8_t count = 1 + arg % 16;
+            int16_t n = nfc.ntag2xx_FastRead(arg, arg + count - 1, buf);
+            CHECK(target, n <= count * 4);
+            break;
+        }
+        case 13:
+        {
+            uint16_t service = 0x000B;
+            uint16_t blockList[FELICA_READ_MAXBLOCKS];
+            uint8_t count = 1 + arg % FELICA_READ_MAXBLOCKS;
+            for (uint8_t i = 0; i < count; i++)
+                blockList[i] = 0x8000 | i;
+            CHECK(target, nfc.felica_ReadWithoutEncryption(1, &service, count, blockList, buf) <= (int8_t)count);
+            break;
+        }
+    }
+    frameSim.arm(0, 0, 0);
+    while (frameSim.available())   // what the function left unread
+        frameSim.read();
+}
+
+
+/***** NDEF target ******/
+
+/*
+ * input: mode, then a TLV stream (mode even) or records (mode odd).
+ * Records found must lie within the message; built records must come
+ * back unchanged from the TLV stream.
+ */
+static void fuzzndef(const uint8_t *data, size_t size)
+{
+    static const char target[] = "ndef";
+    static uint8_t message[FUZZ_MAX_INPUT];
+    static uint8_t built[FUZZ_MAX_INPUT];
+    NDEFParser parser(message, (size > 1) ? 1 + data[1] % 255 : 64);
+    NDEFRecord record;
+
+    if (size < 2)
+        return;
+    uint8_t mode = data[0];
+    data += 2;
+    size -= 2;
+
+    if (!(mode & 1))
+    {
+        // the stream in pieces of 1..16 bytes, as the card is read
+        for (size_t pos = 0; pos < size; pos += 1 + mode % 16)
+        {
+            uint8_t len = (size - pos < 1u + mode % 16) ? size - pos : 1 + mode % 16;
+            if (parser.feed(data + pos, len) != NDEF_PARSE_MORE)
+                break;
+        }
+        if (!parser.isDone())
+            return;
+        const uint8_t *end = parser.message() + parser.messageLength();
+        for (uint16_t n = 0; parser.nextRecord(&record); n++)
+        {
+            CHECK(target, n < parser.messageLength());
+            CHECK(target, record.type >= parser.message() && record.type + record.typeLength <= end);
+            CHECK(target, record.id >= parser.message() && record.id + record.idLength <= end);
+            CHECK(target, record.payload >= parser.message() && record.payloadLength <= (uint32_t)(end - record.payload));
+        }
+        return;
+    }
+
+    // records: tnf, type length, payload length, then the type and payload bytes
+    NDEFMessage out(built, sizeof(built));
+    const uint8_t *starts[64];
+    uint8_t count = 0;
+    size_t pos = 0;
+    while (pos + 3 <= size && count < 64)
+    {
+        uint8_t typeLength = data[pos+1] % 8;
+        uint16_t payloadLength = data[pos+2] * ((mode & 2) ? 3 : 1);
+        if (pos + 3 + typeLength + payloadLength > size)
+            break;
+        starts[count] = data + pos;
+        if (!out.addRecord(data[pos] % 7, data + pos + 3, typeLength, data + pos + 3 + typeLength, payloadLength))
+            break;
+        count++;
+        pos += 3 + typeLength + payloadLength;
+    }
+    if (!count)
+        return;
+
+    NDEFParser back(message, sizeof(message));
+    uint8_t piece[16];
+    int8_t result = NDEF_PARSE_MORE;
+    for (uint16_t offset = 0; offset < out.tlvLength() && result == NDEF_PARSE_MORE; offset += 16)
+    {
+        for (uint8_t i = 0; i < 16; i++)
+            piece[i] = out.tlvByte(offset + i);
+        result = back.feed(piece, 16);
+    }
+    CHECK(target, result == NDEF_PARSE_DONE);
+    CHECK(target, back.messageLength() == out.messageLength() && !memcmp(message, built, out.messageLength()));
+    for (uint8_t i = 0; i < count; i++)
+    {
+        const uint8_t *in = starts[i];
+        uint8_t typeLength = in[1] % 8;
+        uint16_t payloadLength = in[2] * ((mode & 2) ? 3 : 1);
+        CHECK(target, back.nextRecord(&record));
+        CHECK(target, (record.header & NDEF_RECORD_TNF_MASK) == in[0] % 7);
+        CHECK(target, !(record.header & NDEF_RECORD_MB) == (i != 0));
+        CHECK(target, !(record.header & NDEF_RECORD_ME) == (i != count - 1));
+        CHECK(target, record.typeLength == typeLength && !memcmp(record.type, in + 3, typeLength));
+        CHECK(target, record.payloadLength == payloadLength && !memcmp(record.payload, in + 3 + typeLength, payloadLength));
+    }
+    CHECK(target, !back.nextRecord(&record));
+}
+
+
+/***** Address target ******/
+
+static SimPN532 cardSim;
+static DFRNFC cardNfc;
+static uint8_t model[PN532_MIFARE_4K_DATA];
+static unsigned int streamNext;
+
+// The card location of data byte addr, worked out block by block
+static uint8_t *location(unsigned int addr)
+{
+    if (cardSim.card() == SIM_CARD_NTAG216)
+        return cardSim.page(4 + addr / 4) + addr % 4;
+
+    unsigned int index = addr / 16;
+    for (uint16_t b = 1; b < 256; b++)
+    {
+        boolean trailer = (b < 128) ? (b % 4 == 3) : (b % 16 == 15);
+        if (trailer)
+            continue;
+        if (index-- == 0)
+            return cardSim.block(b) + addr % 16;
+    }
+    return 0;
+}
+
+static boolean streamcheck(unsigned int byteAddr, uint8_t *data, uint8_t len, void *context)
+{
+    static const char target[] = "address";
+    (void)context;
+    CHECK(target, byteAddr == streamNext && len > 0 && len <= 16);
+    CHECK(target, byteAddr / 16 == (byteAddr + len - 1) / 16);   // one block at a time
+    CHECK(target, !memcmp(data, model + byteAddr, len));
+    streamNext += len;
+    return 1;
+}
+
+/*
+ * input: card, then operations of 5 bytes: kind, start (2), length (2).
+ * Addresses run a little past the capacity so both edges are hit. The
+ * result must match the model, the blocks outside the data area must
+ * stay as they were.
+ */
+static void fuzzaddress(const uint8_t *data, size_t size)
+{
+    static const char target[] = "address";
+    DFRNFC &nfc = cardNfc;
+    static const unsigned int capacities[3] = {PN532_MIFARE_1K_DATA, PN532_MIFARE_4K_DATA, 872};
+    static uint8_t before[4096];
+    static uint8_t buf[PN532_MIFARE_4K_DATA + 64];
+
+    if (size < 1)
+        return;
+    uint8_t card = SIM_CARD_MIFARE_1K + data[0] % 3;
+    unsigned int capacity = capacities[card - SIM_CARD_MIFARE_1K];
+
+    cardSim.setCard(card);
+    memcpy(before, cardSim.block(0), sizeof(before));
+    memset(model, 0, sizeof(model));
+    CHECK(target, nfc.available() == 1 && nfc.dataCapacity() == capacity);
+
+    for (size_t pos = 1; pos + 5 <= size; pos += 5)
+    {
+        uint8_t kind = data[pos];
+        unsigned int start = ((data[pos+1] << 8) | data[pos+2]) % (capacity + 32);
+        unsigned int length = ((data[pos+3] << 8) | data[pos+4]) % ((kind & 0x80) ? capacity + 1 : 300);
+        boolean inside = length && start < capacity && length <= capacity - start;
+        int result;
+
+        switch (kind % 5)
+        {
+            case 0:   // writeBytes
+                for (unsigned int i = 0; i < length; i++)
+                    buf[i] = kind + pos + i * 7;
+                result = nfc.writeBytes(buf, start, length);
+                CHECK(target, result == (inside ? 1 : -1));
+                if (inside)
+                    memcpy(model + start, buf, length);
+                break;
+            case 1:   // readBytes
+                result = nfc.readBytes(buf, start, length);
+                CHECK(target, result == (inside ? 1 : -1));
+                if (inside)
+                    CHECK(target, !memcmp(buf, model + start, length));
+                break;
+            case 2:   // write
+                result = nfc.write(start, kind ^ pos);
+                CHECK(target, result == ((start < capacity) ? 1 : -1));
+                if (start < capacity)
+                    model[start] = kind ^ pos;
+                break;
+            case 3:   // read
+                result = nfc.read(start);
+                CHECK(target, result == ((start < capacity) ? model[start] : -1));
+                break;
+            case 4:   // readStream
+                streamNext = start;
+                result = nfc.readStream(start, length, streamcheck);
+                CHECK(target, result == (inside ? 1 : -1));
+                if (inside)
+                    CHECK(target, streamNext == start + length);
+                break;
+        }
+    }
+
+    // the data area holds the model, everything else is untouched
+    for (unsigned int addr = 0; addr < capacity; addr++)
+    {
+        uint8_t *at = location(addr);
+        CHECK(target, *at == model[addr]);
+        *at = before[at - cardSim.block(0)];
+    }
+    CHECK(target, !memcmp(before, cardSim.block(0), sizeof(before)));
+}
+
+
+/***** Entry points ******/
+
+static uint32_t runs[FUZZ_TARGETS];
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    static boolean started = 0;
+    if (!started)
+    {
+        frameNfc.begin(frameSim);
+        cardNfc.begin(cardSim);
+        started = 1;
+    }
+    if (size < 1 || size > FUZZ_MAX_INPUT)
+        return 0;
+
+    uint8_t which = data[0] % FUZZ_TARGETS;
+    runs[which]++;
+    switch (which)
+    {
+        case FUZZ_FRAME:
+            fuzzframe(data + 1, size - 1);
+            break;
+        case FUZZ_NDEF:
+            fuzzndef(data + 1, size - 1);
+            break;
+        case FUZZ_ADDRESS:
+            fuzzaddress(data + 1, size - 1);
+            break;
+    }
+    return 0;
+}
+
+#ifndef LIBFUZZER
+
+// Mostly small values and edges, they are the lengths and codes that matter
+static uint8_t randombyte(void)
+{
+    static const uint8_t edges[] = {0x00, 0x03, 0x7F, 0x80, 0xD1, 0xFE, 0xFF};
+
+    switch (rand() % 4)
+    {
+        case 0:
+            return edges[rand() % sizeof(edges)];
+        case 1:
+            return rand();
+        default:
+            return rand() % 8;
+    }
+}
+
+static size_t randominput(uint8_t *input)
+{
+    uint8_t which = rand() % FUZZ_TARGETS;
+    size_t size = 1 + rand() % ((rand() % 4) ? 64 : FUZZ_MAX_INPUT - 1);
+
+    input[0] = which;
+    for (size_t i = 1; i < size; i++)
+        input[i] = randombyte();
+    if (which == FUZZ_FRAME && size > 2)
+        input[2] &= (rand() % 2) ? 0 : 0xFF;    // half of the frames intact
+    if (which == FUZZ_NDEF && size > 5 && !(input[1] & 1) && (rand() % 2))
+    {
+        input[3] = 0x03;    // a message TLV around the rest
+        input[4] = (size - 5 < 0xFF) ? size - 5 : 0xFE;
+        if (size > 11 && (rand() % 2))
+        {
+            input[5] &= ~NDEF_RECORD_SR;    // a long record with a payload length near the top
+            for (size_t i = 7; i < 11; i++)
+                input[i] = (rand() % 4) ? 0xFF : randombyte();
+        }
+    }
+    if (which == FUZZ_ADDRESS)
+        for (size_t i = 2; i < size; i++)
+            input[i] = rand();
+    return size;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long count = 10000;
+    unsigned int seed = 1;
+    int arg = 1;
+    static uint8_t input[FUZZ_MAX_INPUT];
+
+    for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2)
+    {
+        if (!strcmp(argv[arg], "-n"))
+            count = strtoul(argv[arg+1], 0, 0);
+        else if (!strcmp(argv[arg], "-s"))
+            seed = strtoul(argv[arg+1], 0, 0);
+        else
+            break;
+    }
+
+    if (arg < argc)
+    {
+        for (; arg < argc; arg++)
+        {
+            FILE *f = fopen(argv[arg], "rb");
+            if (!f)
+            {
+                perror(argv[arg]);
+                return 2;
+            }
+            size_t size = fread(input, 1, sizeof(input), f);
+            fclose(f);
+            LLVMFuzzerTestOneInput(input, size);
+        }
+    }
+    else
+    {
+        srand(seed);
+        for (unsigned long i = 0; i < count; i++)
+        {
+            size_t size = randominput(input);
+            LLVMFuzzerTestOneInput(input, size);
+        }
+    }
+    printf("frame %lu, ndef %lu, address %lu runs\n",
+           (unsigned long)runs[FUZZ_FRAME], (unsigned long)runs[FUZZ_NDEF], (unsigned long)runs[FUZZ_ADDRESS]);
+
+#ifdef PN532STATS
+    PN532Stats stats;
+    frameNfc.stats(&stats);
+    printf("frame: %lu frames decoded, %lu us per frame recently, %lu us at most\n",
+           (unsigned long)stats.frames, (unsigned long)stats.frameMicros, (unsigned long)stats.maxFrameMicros);
+    cardNfc.stats(&stats);
+    printf("address: %lu frames decoded, %lu us per frame recently, %lu us at most\n",
+           (unsigned long)stats.frames, (unsigned long)stats.frameMicros, (unsigned long)stats.maxFrameMicros);
+#endif
+    return 0;
+}
+
+#endif
@@ -0,0 +1,133 @@
+/***************************************************
+ Measures the scan pipeline (DFRNFC::scan, tapsPerSecond) against the
+ simulated PN532 of SimPN532, on a PC instead of the Arduino.
+
+   scanrate [-n taps] [-b blocks] [-r baud]
+
+ Every tap is a Mifare 1K with its own uid that stays in the field
+ until it is reported and then leaves for one scan. The scan reads
+ the given number of data blocks from sector 1 on, without the
+ trailers (default 3). Every byte on the wire costs the time of 10
+ bits at the given baud rate (default 115200, 0 for none); the air
+ time and the PN532 itself are not modelled, so the rate is what the
+ HSU link allows at most.
+
+ GNU Lesser General Public License.
+ See <http://www.gnu.org/licenses/> for details.
+ ****************************************************/
+
+#include "Arduino.h"
+#include "DFRNFC.h"
+#include "SimPN532.h"
+
+#include <stdio.h>
+
+// SimPN532 with the time of every byte on the HSU
+class WiredPN532 : public SimPN532
+{
+public:
+    unsigned long byteMicros;
+
+    virtual int read(void)
+    {
+        int b = SimPN532::read();
+        if (b >= 0)
+            hostAdvance(byteMicros);
+        return b;
+    }
+    virtual size_t write(uint8_t b)
+    {
+        hostAdvance(byteMicros);
+        return SimPN532::write(b);
+    }
+    using Print::write;
+};
+
+#define RATE_SECTORS                        (16)    // Mifare 1K
+#define RATE_SECTOR_DATA                    (3)     // data blocks in a sector, the trailer is not read
+
+static const uint8_t keyA[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+static WiredPN532 sim;
+static DFRNFC nfc;
+static uint8_t scanBuffer[16 * 48];
+static unsigned long reported;
+
+static void tapped(const uint8_t *uid, uint8_t uidLength, const uint8_t *data, uint16_t len, void *context)
+{
+    (void)uid; (void)uidLength; (void)data; (void)len; (void)context;
+    reported++;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long taps = 1000;
+    unsigned long blocks = 3;
+    unsigned long baud = 115200;
+    int arg = 1;
+
+    for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2)
+    {
+        if (!strcmp(argv[arg], "-n"))
+            taps = strtoul(argv[arg+1], 0, 0);
+        else if (!strcmp(argv[arg], "-b"))
+            blocks = strtoul(argv[arg+1], 0, 0);
+        else if (!strcmp(argv[arg], "-r"))
+            baud = strtoul(argv[arg+1], 0, 0);
+        else
+            break;
+    }
+
+    // the data blocks from sector 1 on, one range per sector
+    PN532ScanRange ranges[RATE_SECTORS];
+    uint8_t count = 0;
+    unsigned long left = blocks;
+    for (uint8_t sector = 1; left && sector < RATE_SECTORS; sector++)
+    {
+        ranges[count].block = sector * 4;
+        ranges[count].blocks = (left < RATE_SECTOR_DATA) ? left : RATE_SECTOR_DATA;
+        ranges[count].keyNumber = 0;
+        ranges[count].key = keyA;
+        left -= ranges[count++].blocks;
+    }
+    if (arg != argc || !taps || !blocks || left)
+    {
+        fprintf(stderr, "usage: %s [-n taps] [-b blocks 1..%u] [-r baud]\n", argv[0], (RATE_SECTORS - 1) * RATE_SECTOR_DATA);
+        return 2;
+    }
+
+    sim.byteMicros = baud ? (10000000UL + baud - 1) / baud : 0;
+    sim.setCard(SIM_CARD_NONE);
+    nfc.begin(sim);
+    if (!nfc.setScan(ranges, count, scanBuffer, sizeof(scanBuffer), tapped))
+    {
+        fprintf(stderr, "setScan failed\n");
+        return 1;
+    }
+
+    unsigned long start = millis();
+    for (unsigned long i = 0; i < taps; i++)
+    {
+        sim.setCard(SIM_CARD_MIFARE_1K);
+        sim.uid[0] = i;
+        sim.uid[1] = i >> 8;
+        sim.uid[2] = i >> 16;
+        if (nfc.scan() != 1)
+        {
+            fprintf(stderr, "tap %lu: scan failed, error %u\n", i, nfc.lastError());
+            return 1;
+        }
+        sim.setCard(SIM_CARD_NONE);
+        nfc.scan();
+    }
+    unsigned long elapsed = millis() - start;
+
+    PN532ScanStats stats;
+    nfc.scanStats(&stats);
+    printf("%lu taps reported, %lu polls, %lu failures\n",
+           reported, (unsigned long)stats.polls, (unsigned long)stats.failures);
+    printf("%lu taps per second (tapsPerSecond), scan time %lu ms, clock %lu ms\n",
+           (unsigned long)nfc.tapsPerSecond(), (unsigned long)stats.millis, elapsed);
+    printf("%lu commands, %lu us per byte on the wire\n", (unsigned long)sim.commands, sim.byteMicros);
+    return (reported == taps && !stats.failures) ? 0 : 1;
+}